@@ -0,0 +1,120 @@
+#include "AdaptiveLimiter.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace ::pplx;
+using namespace QED;
+using namespace std;
+
+AdaptiveLimiterConfig::AdaptiveLimiterConfig()
+	: initialLimit(32), minLimit(4), maxLimit(1024), maxQueued(0), backoffRatio(0.7), tolerance(1.5), smoothing(0.2), probeInterval(1000)
+{
+}
+
+LimitExceeded::LimitExceeded()
+	: runtime_error("too many requests waiting for the concurrency limit")
+{
+}
+
+AdaptiveLimiter::AdaptiveLimiter(const AdaptiveLimiterConfig& config)
+	: m_config(config), m_window(config.initialLimit), m_limit(static_cast<double>(config.initialLimit)), m_minLatency(0), m_samples(0), m_probing(0)
+{
+	if (m_config.minLimit == 0)
+	{
+		m_config.minLimit = 1;
+	}
+	m_config.maxLimit = (max)(m_config.maxLimit, m_config.minLimit);
+	m_limit = (min)((max)(m_limit, static_cast<double>(m_config.minLimit)), static_cast<double>(m_config.maxLimit));
+	m_window.SetLimit(static_cast<size_t>(m_limit));
+}
+
+task<void> AdaptiveLimiter::Acquire()
+{
+	// Checked without holding the window's lock, so the bound on waiters is approximate.
+	if (m_config.maxQueued != 0 && m_window.InFlight() >= m_window.Limit() && m_window.Waiting() >= m_config.maxQueued)
+	{
+		return task_from_exception<void>(LimitExceeded());
+	}
+	return m_window.Acquire();
+}
+
+void AdaptiveLimiter::Release(chrono::steady_clock::duration latency, bool overloaded)
+{
+	size_t inFlight = m_window.InFlight();
+	size_t limit;
+	{
+		lock_guard<mutex> guard(m_lock);
+		auto now = chrono::steady_clock::now();
+		if (overloaded)
+		{
+			// Every request in flight when the broker pushes back tends to report it; one cut per
+			// round trip keeps a single burst from collapsing the limit to its floor.
+			if (now - m_lastBackoff >= latency)
+			{
+				m_limit *= m_config.backoffRatio;
+				m_lastBackoff = now;
+			}
+		}
+		else
+		{
+			double sample = (max)(1.0, static_cast<double>(chrono::duration_cast<chrono::microseconds>(latency).count()));
+			if (++m_samples >= m_config.probeInterval)
+			{
+				// Latency measured at the limit itself would only ratchet the baseline upwards, so
+				// halve the limit and take the baseline afresh once the broker has drained.
+				m_limit /= 2;
+				m_minLatency = 0;
+				m_samples = 0;
+				m_probing = inFlight;
+			}
+			else if (m_probing > 0)
+			{
+				--m_probing;
+			}
+			else if (m_minLatency == 0 || sample < m_minLatency)
+			{
+				m_minLatency = sample;
+			}
+			if (m_minLatency > 0)
+			{
+				double gradient = (max)(0.5, (min)(1.0, m_config.tolerance * m_minLatency / sample));
+				double estimate = m_limit * gradient + sqrt(m_limit);
+				// A producer using under half its slots says nothing about whether more would be safe.
+				if (estimate > m_limit && inFlight * 2 < m_limit)
+				{
+					estimate = m_limit;
+				}
+				m_limit += (estimate - m_limit) * m_config.smoothing;
+			}
+		}
+		m_limit = (min)((max)(m_limit, static_cast<double>(m_config.minLimit)), static_cast<double>(m_config.maxLimit));
+		limit = static_cast<size_t>(m_limit);
+	}
+	m_window.SetLimit(limit);
+	m_window.Release();
+}
+
+void AdaptiveLimiter::Abort()
+{
+	m_window.Release();
+}
+
+task<void> AdaptiveLimiter::WhenIdle()
+{
+	return m_window.WhenIdle();
+}
+
+size_t AdaptiveLimiter::Limit() const
+{
+	return m_window.Limit();
+}
+
+size_t AdaptiveLimiter::InFlight() const
+{
+	return m_window.InFlight();
+}
+
+size_t AdaptiveLimiter::Waiting() const
+{
+	return m_window.Waiting();
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <pplx/pplxtasks.h>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include "InFlightWindow.h"
+
+namespace QED
+{
+	struct AdaptiveLimiterConfig
+	{
+		AdaptiveLimiterConfig();
+
+		size_t initialLimit;
+		size_t minLimit;
+		size_t maxLimit;
+		// Callers beyond this many waiting for a slot fail at once with LimitExceeded; 0 lets them
+		// all queue.
+		size_t maxQueued;
+		// The limit is multiplied by this on a throttle response or transport failure, at most once
+		// per round trip.
+		double backoffRatio;
+		// Latency up to this multiple of the lowest seen is taken as healthy; beyond it the limit
+		// shrinks in proportion.
+		double tolerance;
+		// Weight of each sample when moving the limit towards its new estimate.
+		double smoothing;
+		// Every this many samples the limit is halved and the lowest latency measured again, so a
+		// lasting change in the broker's base latency is picked up.
+		size_t probeInterval;
+	};
+
+	class LimitExceeded : public std::runtime_error
+	{
+	public:
+		LimitExceeded();
+	};
+
+	// Concurrency limit that follows the broker's capacity. Throttle responses and failures cut the
+	// limit multiplicatively; otherwise it moves by the latency gradient, the ratio of the lowest
+	// latency seen to the current one, plus a sqrt(limit) allowance, so it grows while latency
+	// stays flat and backs off as requests start to queue at the broker.
+	class AdaptiveLimiter
+	{
+	public:
+		explicit AdaptiveLimiter(const AdaptiveLimiterConfig& config = AdaptiveLimiterConfig());
+
+		// Completes once a slot is free, or fails with LimitExceeded when too many are waiting.
+		pplx::task<void> Acquire();
+		// Frees the slot of an admitted request and feeds its outcome into the limit.
+		void Release(std::chrono::steady_clock::duration latency, bool overloaded);
+		// Frees the slot of a request that ended without an answer worth learning from, such as a
+		// cancelled one, leaving the limit as it is.
+		void Abort();
+		pplx::task<void> WhenIdle();
+		size_t Limit() const;
+		size_t InFlight() const;
+		size_t Waiting() const;
+
+	private:
+		AdaptiveLimiterConfig m_config;
+		InFlightWindow m_window;
+		double m_limit;
+		double m_minLatency;
+		size_t m_samples;
+		// Samples still to skip after a probe, while requests admitted under the old limit complete.
+		size_t m_probing;
+		std::chrono::steady_clock::time_point m_lastBackoff;
+		std::mutex m_lock;
+
+		AdaptiveLimiter(const AdaptiveLimiter&);
+		AdaptiveLimiter& operator=(const AdaptiveLimiter&);
+	};
+}
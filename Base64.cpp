@@ -0,0 +1,245 @@
+#include "Base64.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define QED_TARGET_SSSE3
+#else
+#define QED_TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+#include <tmmintrin.h>
+#include <stdexcept>
+
+using namespace QED;
+using namespace utility;
+using namespace std;
+
+namespace
+{
+	const char Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+	// Maps each byte to its 6-bit value, or 0xFF when it is not in the alphabet.
+	struct DecodeTable
+	{
+		uint8_t values[256];
+
+		DecodeTable()
+		{
+			for (size_t i = 0; i < 256; ++i)
+			{
+				values[i] = 0xFF;
+			}
+			for (uint8_t i = 0; i < 64; ++i)
+			{
+				values[static_cast<uint8_t>(Alphabet[i])] = i;
+			}
+		}
+	};
+
+	const DecodeTable Table;
+
+	void Invalid()
+	{
+		throw runtime_error("invalid base64 text");
+	}
+
+	template <typename Char>
+	void EncodeScalar(const uint8_t* data, size_t length, Char* out)
+	{
+		size_t i = 0;
+		for (; i + 3 <= length; i += 3)
+		{
+			unsigned group = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+			*out++ = static_cast<Char>(Alphabet[group >> 18]);
+			*out++ = static_cast<Char>(Alphabet[(group >> 12) & 0x3F]);
+			*out++ = static_cast<Char>(Alphabet[(group >> 6) & 0x3F]);
+			*out++ = static_cast<Char>(Alphabet[group & 0x3F]);
+		}
+		if (i < length)
+		{
+			unsigned group = data[i] << 16;
+			if (i + 1 < length)
+			{
+				group |= data[i + 1] << 8;
+			}
+			*out++ = static_cast<Char>(Alphabet[group >> 18]);
+			*out++ = static_cast<Char>(Alphabet[(group >> 12) & 0x3F]);
+			*out++ = static_cast<Char>(i + 1 < length ? Alphabet[(group >> 6) & 0x3F] : '=');
+			*out++ = static_cast<Char>('=');
+		}
+	}
+
+	// Decodes whole quads, the last of which may be padded, and returns the bytes written.
+	size_t DecodeScalar(const uint8_t* text, size_t length, uint8_t* out)
+	{
+		uint8_t* start = out;
+		for (size_t i = 0; i < length; i += 4)
+		{
+			bool last = i + 4 == length;
+			size_t padding = last ? (text[i + 3] == '=') + (text[i + 2] == '=') : 0;
+			uint8_t a = Table.values[text[i]];
+			uint8_t b = Table.values[text[i + 1]];
+			uint8_t c = padding > 1 ? 0 : Table.values[text[i + 2]];
+			uint8_t d = padding > 0 ? 0 : Table.values[text[i + 3]];
+			if ((a | b | c | d) == 0xFF)
+			{
+				Invalid();
+			}
+			unsigned group = (a << 18) | (b << 12) | (c << 6) | d;
+			*out++ = static_cast<uint8_t>(group >> 16);
+			if (padding < 2)
+			{
+				*out++ = static_cast<uint8_t>(group >> 8);
+			}
+			if (padding < 1)
+			{
+				*out++ = static_cast<uint8_t>(group);
+			}
+		}
+		return out - start;
+	}
+
+	// Spreads 12 input bytes into 16 six-bit indices and maps them to ASCII (after W. Mula's
+	// SSSE3 base64 encoder): each index range gets its offset from a 16-entry pshufb table.
+	QED_TARGET_SSSE3 __m128i EncodeBlock(__m128i input)
+	{
+		input = _mm_shuffle_epi8(input, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+		__m128i high = _mm_mulhi_epu16(_mm_and_si128(input, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040));
+		__m128i low = _mm_mullo_epi16(_mm_and_si128(input, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010));
+		__m128i indices = _mm_or_si128(high, low);
+		__m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+		range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+		const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+			'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+		return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+	}
+
+	// Vector part of the encoders; returns the input bytes consumed, a multiple of 12. Each step
+	// loads 16 bytes, so the loop stops while at least that many remain.
+	QED_TARGET_SSSE3 size_t EncodeSsse3(const uint8_t* data, size_t length, char* out)
+	{
+		size_t i = 0;
+		for (; i + 16 <= length; i += 12, out += 16)
+		{
+			__m128i block = EncodeBlock(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), block);
+		}
+		return i;
+	}
+
+	QED_TARGET_SSSE3 size_t EncodeSsse3(const uint8_t* data, size_t length, utf16char* out)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		size_t i = 0;
+		for (; i + 16 <= length; i += 12, out += 16)
+		{
+			__m128i block = EncodeBlock(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(block, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm_unpackhi_epi8(block, zero));
+		}
+		return i;
+	}
+
+	// Validates and packs 16 characters into 12 bytes (after W. Mula's SSSE3 decoder): the nibble
+	// tables flag anything outside the alphabet, and a third table gives each range its offset.
+	// Returns the characters consumed, a multiple of 16. Each step stores 16 bytes for 12, so the
+	// loop leaves at least two quads, which decode to at least 4 bytes, to absorb the overrun.
+	QED_TARGET_SSSE3 size_t DecodeSsse3(const uint8_t* text, size_t length, uint8_t* out)
+	{
+		const __m128i lowFlags = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+		const __m128i highFlags = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+		const __m128i offsets = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+		const __m128i nibble = _mm_set1_epi8(0x0F);
+		const __m128i slash = _mm_set1_epi8('/');
+		const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+		size_t i = 0;
+		for (; i + 24 <= length; i += 16, out += 12)
+		{
+			__m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+			__m128i high = _mm_and_si128(_mm_srli_epi32(input, 4), nibble);
+			__m128i flags = _mm_and_si128(_mm_shuffle_epi8(lowFlags, _mm_and_si128(input, nibble)), _mm_shuffle_epi8(highFlags, high));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(flags, _mm_setzero_si128())) != 0xFFFF)
+			{
+				break;
+			}
+			__m128i values = _mm_add_epi8(input, _mm_shuffle_epi8(offsets, _mm_add_epi8(_mm_cmpeq_epi8(input, slash), high)));
+			__m128i merged = _mm_madd_epi16(_mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140)), _mm_set1_epi32(0x00011000));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(merged, pack));
+		}
+		return i;
+	}
+
+	bool HasSsse3()
+	{
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 9)) != 0;
+#else
+		return __builtin_cpu_supports("ssse3") != 0;
+#endif
+	}
+
+	const bool UseSsse3 = HasSsse3();
+}
+
+size_t QED::Base64EncodedLength(size_t bytes)
+{
+	return (bytes + 2) / 3 * 4;
+}
+
+size_t QED::Base64DecodedLength(const char* text, size_t length)
+{
+	if (length % 4 != 0)
+	{
+		Invalid();
+	}
+	if (length == 0)
+	{
+		return 0;
+	}
+	size_t padding = (text[length - 1] == '=') + (text[length - 2] == '=');
+	return length / 4 * 3 - padding;
+}
+
+void QED::Base64Encode(const uint8_t* data, size_t length, char* out)
+{
+	size_t done = UseSsse3 ? EncodeSsse3(data, length, out) : 0;
+	EncodeScalar(data + done, length - done, out + done / 3 * 4);
+}
+
+void QED::Base64Encode(const uint8_t* data, size_t length, utf16char* out)
+{
+	size_t done = UseSsse3 ? EncodeSsse3(data, length, out) : 0;
+	EncodeScalar(data + done, length - done, out + done / 3 * 4);
+}
+
+size_t QED::Base64Decode(const char* text, size_t length, uint8_t* out)
+{
+	if (length % 4 != 0)
+	{
+		Invalid();
+	}
+	const uint8_t* input = reinterpret_cast<const uint8_t*>(text);
+	// A block with an invalid character stops the vector loop; the scalar loop then rejects it.
+	size_t done = UseSsse3 ? DecodeSsse3(input, length, out) : 0;
+	return done / 4 * 3 + DecodeScalar(input + done, length - done, out + done / 4 * 3);
+}
+
+void QED::AppendBase64(const uint8_t* data, size_t length, string& out)
+{
+	size_t base = out.size();
+	out.resize(base + Base64EncodedLength(length));
+	if (length > 0)
+	{
+		Base64Encode(data, length, &out[base]);
+	}
+}
+
+string_t QED::ToBase64(const uint8_t* data, size_t length)
+{
+	string_t result(Base64EncodedLength(length), 0);
+	if (length > 0)
+	{
+		Base64Encode(data, length, &result[0]);
+	}
+	return result;
+}
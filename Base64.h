@@ -0,0 +1,26 @@
+#pragma once
+#include <cpprest/asyncrt_utils.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace QED
+{
+	// Standard padded base64 over caller-supplied buffers, so nothing is allocated per call.
+	// Blocks of 12 bytes are encoded and 16 characters decoded per step with SSSE3 when the CPU has
+	// it; the tail and older CPUs use a table-driven loop.
+
+	size_t Base64EncodedLength(size_t bytes);
+	// Exact size of the decoded data; throws std::runtime_error unless length is a multiple of 4.
+	size_t Base64DecodedLength(const char* text, size_t length);
+
+	// out must hold Base64EncodedLength(length) characters; no terminator is written.
+	void Base64Encode(const uint8_t* data, size_t length, char* out);
+	void Base64Encode(const uint8_t* data, size_t length, utf16char* out);
+	// out must hold Base64DecodedLength(text, length) bytes. Returns the number written and throws
+	// std::runtime_error on characters outside the alphabet or misplaced padding.
+	size_t Base64Decode(const char* text, size_t length, uint8_t* out);
+
+	void AppendBase64(const uint8_t* data, size_t length, std::string& out);
+	utility::string_t ToBase64(const uint8_t* data, size_t length);
+}
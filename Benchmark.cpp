@@ -0,0 +1,304 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cpprest/json.h>
+#include <cpprest/producerconsumerstream.h>
+#include "MockBroker.h"
+#include "ServiceQueue.h"
+
+using namespace ::pplx;
+using namespace web;
+using namespace QED;
+using namespace utility;
+using namespace std;
+
+namespace
+{
+	typedef chrono::steady_clock Clock;
+
+	struct BenchmarkCase
+	{
+		size_t messageSize;
+		size_t concurrency;
+		size_t batchSize;
+	};
+
+	// Latencies are gathered per request and only sorted once the phase is over.
+	struct Phase
+	{
+		Phase() : messages(0), bytes(0), requests(0), seconds(0) {}
+
+		void Record(Clock::time_point started, size_t count, size_t size)
+		{
+			double ms = chrono::duration<double, milli>(Clock::now() - started).count();
+			lock_guard<mutex> guard(lock);
+			latencies.push_back(ms);
+			messages += count;
+			bytes += size;
+			++requests;
+		}
+
+		json::value Report()
+		{
+			sort(latencies.begin(), latencies.end());
+			json::value latency;
+			latency[L"p50"] = json::value::number(Percentile(0.5));
+			latency[L"p99"] = json::value::number(Percentile(0.99));
+			latency[L"p999"] = json::value::number(Percentile(0.999));
+			json::value report;
+			report[L"messages"] = json::value::number(static_cast<double>(messages));
+			report[L"requests"] = json::value::number(static_cast<double>(requests));
+			report[L"seconds"] = json::value::number(seconds);
+			report[L"msgsPerSec"] = json::value::number(seconds > 0 ? messages / seconds : 0);
+			report[L"bytesPerSec"] = json::value::number(seconds > 0 ? bytes / seconds : 0);
+			report[L"latencyMs"] = latency;
+			return report;
+		}
+
+		double Percentile(double p) const
+		{
+			if (latencies.empty())
+			{
+				return 0;
+			}
+			size_t rank = static_cast<size_t>(p * latencies.size());
+			return latencies[(min)(rank, latencies.size() - 1)];
+		}
+
+		size_t messages;
+		size_t bytes;
+		size_t requests;
+		double seconds;
+		vector<double> latencies;
+		mutex lock;
+	};
+
+	vector<size_t> ParseList(const wstring& text)
+	{
+		vector<size_t> values;
+		wistringstream in(text);
+		wstring item;
+		while (getline(in, item, L','))
+		{
+			values.push_back(static_cast<size_t>(stoul(item)));
+		}
+		return values;
+	}
+
+	// p50/p99 in milliseconds for each phase the queue recorded during the case.
+	json::value PhaseReport(const LatencyMetrics& metrics)
+	{
+		json::value report = json::value::object();
+		for (size_t i = 0; i < LatencyMetrics::PhaseCount; ++i)
+		{
+			LatencyPhase phase = static_cast<LatencyPhase>(i);
+			LatencySnapshot snapshot = metrics.Snapshot(phase);
+			if (snapshot.count == 0)
+			{
+				continue;
+			}
+			json::value latency;
+			latency[L"p50"] = json::value::number(snapshot.Percentile(0.5) / 1000);
+			latency[L"p99"] = json::value::number(snapshot.Percentile(0.99) / 1000);
+			report[LatencyMetrics::PhaseName(phase)] = latency;
+		}
+		return report;
+	}
+
+	json::value MakeMessage(size_t index, size_t size)
+	{
+		json::value message;
+		message[L"seq"] = json::value::number(static_cast<double>(index));
+		message[L"data"] = json::value::string(wstring(size, L'x'));
+		return message;
+	}
+
+	// Each lane keeps one send in flight and claims the next slice of messages when it finishes.
+	task<void> SendLane(ServiceQueue& queue, const wstring& endpoint, const wstring& authcode, const BenchmarkCase& run, size_t total, shared_ptr<atomic<size_t>> next, shared_ptr<Phase> phase)
+	{
+		size_t first = next->fetch_add(run.batchSize);
+		if (first >= total)
+		{
+			return task_from_result();
+		}
+		size_t count = (min)(run.batchSize, total - first);
+		auto started = Clock::now();
+		task<void> sent;
+		if (run.batchSize == 1)
+		{
+			sent = queue.SendAsync(endpoint, authcode, MakeMessage(first, run.messageSize)).then([phase, started](SendResult result)
+			{
+				phase->Record(started, result.messages, result.bytes);
+			});
+		}
+		else
+		{
+			vector<json::value> batch;
+			for (size_t i = 0; i < count; ++i)
+			{
+				batch.push_back(MakeMessage(first + i, run.messageSize));
+			}
+			sent = queue.SendBatch(endpoint, authcode, batch).then([phase, started](vector<SendResult> results)
+			{
+				for (auto& result : results)
+				{
+					phase->Record(started, result.messages, result.bytes);
+				}
+			});
+		}
+		return sent.then([&queue, endpoint, authcode, run, total, next, phase]()
+		{
+			return SendLane(queue, endpoint, authcode, run, total, next, phase);
+		});
+	}
+
+	// The lane that takes the last message cancels the others' long polls, so the phase does not
+	// also time the idle poll tail.
+	task<void> ReceiveLane(ServiceQueue& queue, const wstring& endpoint, const wstring& authcode, size_t total, shared_ptr<atomic<size_t>> received, cancellation_token_source done, shared_ptr<Phase> phase)
+	{
+		if (*received >= total)
+		{
+			return task_from_result();
+		}
+		auto started = Clock::now();
+		return queue.ReceiveAsync(endpoint, authcode, ReceiveMode::PeekLock, CallOptions(done.get_token())).then([&queue, endpoint, authcode, total, received, done, phase, started](task<ReceivedMessage> polled)
+		{
+			ReceivedMessage message;
+			try
+			{
+				message = polled.get();
+			}
+			catch (...)
+			{
+				if (done.get_token().is_canceled())
+				{
+					return task_from_result();
+				}
+				throw;
+			}
+			if (!message.HasMessage())
+			{
+				return task_from_result();
+			}
+			phase->Record(started, 1, message.Size());
+			queue.Complete(message, authcode);
+			if (++*received == total)
+			{
+				done.cancel();
+				return task_from_result();
+			}
+			return ReceiveLane(queue, endpoint, authcode, total, received, done, phase);
+		});
+	}
+
+	json::value Run(const wstring& queueUri, const wstring& authcode, const BenchmarkCase& run, size_t total)
+	{
+		ServiceQueueConfig config;
+		config.maxInFlight = run.concurrency;
+		config.pool.maxConnectionsPerHost = run.concurrency;
+		ServiceQueue queue(config);
+		wstring sendEndpoint = queueUri + L"/messages";
+		wstring receiveEndpoint = queueUri + L"/messages/head?timeout=1";
+
+		auto send = make_shared<Phase>();
+		auto next = make_shared<atomic<size_t>>(0);
+		vector<task<void>> lanes;
+		auto started = Clock::now();
+		for (size_t i = 0; i < run.concurrency; ++i)
+		{
+			lanes.push_back(SendLane(queue, sendEndpoint, authcode, run, total, next, send));
+		}
+		when_all(lanes.begin(), lanes.end()).wait();
+		send->seconds = chrono::duration<double>(Clock::now() - started).count();
+
+		auto receive = make_shared<Phase>();
+		auto received = make_shared<atomic<size_t>>(0);
+		cancellation_token_source done;
+		lanes.clear();
+		started = Clock::now();
+		for (size_t i = 0; i < run.concurrency; ++i)
+		{
+			lanes.push_back(ReceiveLane(queue, receiveEndpoint, authcode, total, received, done, receive));
+		}
+		when_all(lanes.begin(), lanes.end()).wait();
+		queue.Drain().wait();
+		receive->seconds = chrono::duration<double>(Clock::now() - started).count();
+
+		json::value result;
+		result[L"messageSize"] = json::value::number(static_cast<double>(run.messageSize));
+		result[L"concurrency"] = json::value::number(static_cast<double>(run.concurrency));
+		result[L"batchSize"] = json::value::number(static_cast<double>(run.batchSize));
+		result[L"send"] = send->Report();
+		result[L"receive"] = receive->Report();
+		result[L"sendPhasesMs"] = PhaseReport(queue.SendLatency());
+		result[L"receivePhasesMs"] = PhaseReport(queue.ReceiveLatency());
+		result[L"sendLimit"] = json::value::number(static_cast<double>(queue.SendLimiter().Limit()));
+		result[L"retries"] = json::value::number(static_cast<double>(queue.Retry().Retries()));
+		result[L"retriesThrottled"] = json::value::number(static_cast<double>(queue.Retry().Throttled()));
+		result[L"hedged"] = json::value::number(static_cast<double>(queue.Hedged()));
+		return result;
+	}
+}
+
+// QueueBenchmark [--queue <queue uri>] [--auth <sas>] [--messages N] [--sizes a,b] [--concurrency a,b] [--batch a,b]
+// Without --queue the sweep runs against an in-process MockBroker. Results are written to stdout as JSON.
+int wmain(int argc, wchar_t* argv[])
+{
+	wstring queueUri;
+	wstring authcode;
+	size_t total = 2000;
+	vector<size_t> sizes = ParseList(L"256,4096,65536");
+	vector<size_t> concurrency = ParseList(L"1,16,64");
+	vector<size_t> batches = ParseList(L"1,10,100");
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		wstring name = argv[i];
+		wstring value = argv[i + 1];
+		if (name == L"--queue") queueUri = value;
+		else if (name == L"--auth") authcode = value;
+		else if (name == L"--messages") total = static_cast<size_t>(stoul(value));
+		else if (name == L"--sizes") sizes = ParseList(value);
+		else if (name == L"--concurrency") concurrency = ParseList(value);
+		else if (name == L"--batch") batches = ParseList(value);
+	}
+
+	unique_ptr<MockBroker> broker;
+	if (queueUri.empty())
+	{
+		broker.reset(new MockBroker(uri(L"http://localhost:8766/")));
+		broker->Open();
+		queueUri = L"http://localhost:8766/benchmark";
+	}
+
+	json::value results = json::value::array();
+	size_t index = 0;
+	for (auto size : sizes)
+	{
+		for (auto lanes : concurrency)
+		{
+			for (auto batch : batches)
+			{
+				BenchmarkCase run = { size, lanes == 0 ? 1 : lanes, batch == 0 ? 1 : batch };
+				results[index++] = Run(queueUri, authcode, run, total);
+			}
+		}
+	}
+	json::value report;
+	report[L"queue"] = json::value::string(queueUri);
+	report[L"mock"] = json::value::boolean(broker != nullptr);
+	report[L"messagesPerCase"] = json::value::number(static_cast<double>(total));
+	report[L"results"] = results;
+	auto blocks = Concurrency::streams::details::_block_pool::stats();
+	json::value blockPool;
+	blockPool[L"hits"] = json::value::number(static_cast<double>(blocks.hits));
+	blockPool[L"misses"] = json::value::number(static_cast<double>(blocks.misses));
+	blockPool[L"hitRate"] = json::value::number(blocks.hit_rate());
+	report[L"blockPool"] = blockPool;
+	wcout << report.serialize() << endl;
+	return 0;
+}
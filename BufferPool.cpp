@@ -0,0 +1,133 @@
+#include "BufferPool.h"
+
+using namespace QED;
+using namespace std;
+
+PooledBuffer::PooledBuffer(uint8_t* data, size_t capacity)
+	: m_data(data), m_capacity(capacity), m_size(0)
+{
+}
+
+uint8_t* PooledBuffer::Data()
+{
+	return m_data;
+}
+
+const uint8_t* PooledBuffer::Data() const
+{
+	return m_data;
+}
+
+size_t PooledBuffer::Capacity() const
+{
+	return m_capacity;
+}
+
+size_t PooledBuffer::Size() const
+{
+	return m_size;
+}
+
+void PooledBuffer::SetSize(size_t size)
+{
+	m_size = size < m_capacity ? size : m_capacity;
+}
+
+BufferPool::State::~State()
+{
+	for (auto& sizeClass : free)
+	{
+		for (auto data : sizeClass)
+		{
+			delete[] data;
+		}
+	}
+}
+
+BufferPool::BufferPool(size_t maxCachedPerClass, size_t maxCachedBytes)
+	: m_state(make_shared<State>())
+{
+	m_state->maxCached = maxCachedPerClass;
+	m_state->maxCachedBytes = maxCachedBytes;
+	m_state->cachedBytes = 0;
+	m_state->free.resize(ClassOf(MaxClassBytes) + 1);
+}
+
+shared_ptr<PooledBuffer> BufferPool::Acquire(size_t size)
+{
+	if (size > MaxClassBytes)
+	{
+		return shared_ptr<PooledBuffer>(new PooledBuffer(new uint8_t[size], size), [](PooledBuffer* buffer)
+		{
+			delete[] buffer->Data();
+			delete buffer;
+		});
+	}
+	size_t sizeClass = ClassOf(size);
+	size_t capacity = MinClassBytes << sizeClass;
+	uint8_t* data = nullptr;
+	{
+		lock_guard<mutex> guard(m_state->lock);
+		auto& free = m_state->free[sizeClass];
+		if (!free.empty())
+		{
+			data = free.back();
+			free.pop_back();
+			m_state->cachedBytes -= capacity;
+		}
+	}
+	if (data == nullptr)
+	{
+		data = new uint8_t[capacity];
+	}
+	auto state = m_state;
+	return shared_ptr<PooledBuffer>(new PooledBuffer(data, capacity), [state, sizeClass, capacity](PooledBuffer* buffer)
+	{
+		uint8_t* data = buffer->Data();
+		delete buffer;
+		{
+			lock_guard<mutex> guard(state->lock);
+			auto& free = state->free[sizeClass];
+			if (free.size() < state->maxCached && state->cachedBytes + capacity <= state->maxCachedBytes)
+			{
+				free.push_back(data);
+				state->cachedBytes += capacity;
+				return;
+			}
+		}
+		delete[] data;
+	});
+}
+
+void BufferPool::Trim()
+{
+	vector<vector<uint8_t*>> released(m_state->free.size());
+	{
+		lock_guard<mutex> guard(m_state->lock);
+		released.swap(m_state->free);
+		m_state->cachedBytes = 0;
+	}
+	for (auto& sizeClass : released)
+	{
+		for (auto data : sizeClass)
+		{
+			delete[] data;
+		}
+	}
+}
+
+size_t BufferPool::CachedBytes() const
+{
+	lock_guard<mutex> guard(m_state->lock);
+	return m_state->cachedBytes;
+}
+
+size_t BufferPool::ClassOf(size_t size)
+{
+	size_t sizeClass = 0;
+	while ((MinClassBytes << sizeClass) < size)
+	{
+		++sizeClass;
+	}
+	return sizeClass;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace QED
+{
+	// A byte buffer drawn from a BufferPool. Its storage goes back to the pool when the last
+	// shared_ptr to it is released, so views into Data() stay valid for as long as one is held.
+	class PooledBuffer
+	{
+	public:
+		PooledBuffer(uint8_t* data, size_t capacity);
+
+		uint8_t* Data();
+		const uint8_t* Data() const;
+		size_t Capacity() const;
+		size_t Size() const;
+		void SetSize(size_t size);
+
+	private:
+		uint8_t* m_data;
+		size_t m_capacity;
+		size_t m_size;
+	};
+
+	// Recycles buffers in power-of-two size classes from MinClassBytes to MaxClassBytes; larger
+	// requests are allocated exactly and freed on release. The free lists together never hold more
+	// than maxCachedBytes, so one burst of large bodies cannot pin its peak footprint.
+	class BufferPool
+	{
+	public:
+		static const size_t MinClassBytes = 1024;
+		static const size_t MaxClassBytes = 16 * 1024 * 1024;
+
+		explicit BufferPool(size_t maxCachedPerClass = 64, size_t maxCachedBytes = 32 * 1024 * 1024);
+
+		std::shared_ptr<PooledBuffer> Acquire(size_t size);
+		// Frees every cached buffer; buffers still held are recycled as usual when released.
+		void Trim();
+		size_t CachedBytes() const;
+
+	private:
+		struct State
+		{
+			~State();
+
+			std::vector<std::vector<uint8_t*>> free;
+			size_t maxCached;
+			size_t maxCachedBytes;
+			size_t cachedBytes;
+			mutable std::mutex lock;
+		};
+
+		static size_t ClassOf(size_t size);
+
+		std::shared_ptr<State> m_state;
+	};
+}
@@ -0,0 +1,66 @@
+#include "CallCancellation.h"
+
+using namespace ::pplx;
+using namespace QED;
+using namespace std;
+
+CallCancellation::CallCancellation(TaskTimer& timer, chrono::milliseconds timeout, cancellation_token first, cancellation_token second)
+	: m_released(false)
+{
+	Link(first);
+	Link(second);
+	if (timeout.count() > 0)
+	{
+		cancellation_token_source source = m_source;
+		timer.After(timeout, m_deadline.get_token()).then([source](task<void> due)
+		{
+			try
+			{
+				due.get();
+				source.cancel();
+			}
+			catch (const task_canceled&)
+			{
+				// Released before the deadline.
+			}
+		});
+	}
+}
+
+CallCancellation::~CallCancellation()
+{
+	Release();
+}
+
+cancellation_token CallCancellation::Token() const
+{
+	return m_source.get_token();
+}
+
+void CallCancellation::Release()
+{
+	if (m_released)
+	{
+		return;
+	}
+	m_released = true;
+	for (auto& link : m_links)
+	{
+		link.first.deregister_callback(link.second);
+	}
+	m_links.clear();
+	m_deadline.cancel();
+}
+
+void CallCancellation::Link(const cancellation_token& parent)
+{
+	if (!parent.is_cancelable())
+	{
+		return;
+	}
+	cancellation_token_source source = m_source;
+	m_links.push_back(make_pair(parent, parent.register_callback([source]()
+	{
+		source.cancel();
+	})));
+}
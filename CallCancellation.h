@@ -0,0 +1,34 @@
+#pragma once
+#include <pplx/pplxtasks.h>
+#include <chrono>
+#include <utility>
+#include <vector>
+#include "TaskTimer.h"
+
+namespace QED
+{
+	// Cancellation for a single call: the token is cancelled when either parent is, or once the
+	// timeout has passed (zero for no deadline). create_linked_source never unlinks, so a
+	// long-lived parent such as a queue's shutdown token would keep a callback per call; Release
+	// removes the links and the pending deadline instead, and must run before the timer is gone.
+	class CallCancellation
+	{
+	public:
+		CallCancellation(TaskTimer& timer, std::chrono::milliseconds timeout, pplx::cancellation_token first, pplx::cancellation_token second);
+		~CallCancellation();
+
+		pplx::cancellation_token Token() const;
+		void Release();
+
+	private:
+		void Link(const pplx::cancellation_token& parent);
+
+		pplx::cancellation_token_source m_source;
+		pplx::cancellation_token_source m_deadline;
+		std::vector<std::pair<pplx::cancellation_token, pplx::cancellation_token_registration>> m_links;
+		bool m_released;
+
+		CallCancellation(const CallCancellation&);
+		CallCancellation& operator=(const CallCancellation&);
+	};
+}
@@ -0,0 +1,99 @@
+#include "ClientPool.h"
+#include <algorithm>
+
+using namespace web;
+using namespace web::http::client;
+using namespace QED;
+using namespace std;
+
+ClientPoolConfig::ClientPoolConfig()
+	: maxConnectionsPerHost(8), idleTimeout(60)
+{
+}
+
+ClientPool::ClientPool(const ClientPoolConfig& config)
+	: m_config(config)
+{
+	if (m_config.maxConnectionsPerHost == 0)
+	{
+		m_config.maxConnectionsPerHost = 1;
+	}
+}
+
+shared_ptr<http_client> ClientPool::Acquire(const uri& endpoint)
+{
+	uri authority = endpoint.authority();
+	long long now = Now();
+	shared_ptr<Entry> chosen;
+	{
+		lock_guard<mutex> guard(m_lock);
+		Host& host = m_hosts[authority.to_string()];
+		EvictIdle(host, now);
+		for (auto& entry : host)
+		{
+			if (!chosen || entry->inFlight < chosen->inFlight)
+			{
+				chosen = entry;
+			}
+		}
+		if (!chosen || (chosen->inFlight > 0 && host.size() < m_config.maxConnectionsPerHost))
+		{
+			chosen = make_shared<Entry>();
+			chosen->client = make_shared<http_client>(authority, m_config.clientConfig);
+			chosen->inFlight = 0;
+			host.push_back(chosen);
+		}
+		++chosen->inFlight;
+		chosen->lastUsed = now;
+	}
+	return shared_ptr<http_client>(chosen->client.get(), [chosen](http_client*)
+	{
+		chosen->lastUsed = Now();
+		--chosen->inFlight;
+	});
+}
+
+size_t ClientPool::EvictIdle()
+{
+	long long now = Now();
+	size_t evicted = 0;
+	lock_guard<mutex> guard(m_lock);
+	for (auto it = m_hosts.begin(); it != m_hosts.end();)
+	{
+		evicted += EvictIdle(it->second, now);
+		it = it->second.empty() ? m_hosts.erase(it) : ++it;
+	}
+	return evicted;
+}
+
+size_t ClientPool::EvictIdle(Host& host, long long now)
+{
+	long long limit = chrono::duration_cast<chrono::steady_clock::duration>(m_config.idleTimeout).count();
+	size_t before = host.size();
+	host.erase(remove_if(host.begin(), host.end(), [now, limit](const shared_ptr<Entry>& entry)
+	{
+		return entry->inFlight == 0 && now - entry->lastUsed > limit;
+	}), host.end());
+	return before - host.size();
+}
+
+size_t ClientPool::Size() const
+{
+	lock_guard<mutex> guard(m_lock);
+	size_t size = 0;
+	for (auto& host : m_hosts)
+	{
+		size += host.second.size();
+	}
+	return size;
+}
+
+const ClientPoolConfig& ClientPool::Config() const
+{
+	return m_config;
+}
+
+long long ClientPool::Now()
+{
+	return chrono::steady_clock::now().time_since_epoch().count();
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <cpprest/http_client.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace QED
+{
+	struct ClientPoolConfig
+	{
+		ClientPoolConfig();
+
+		// Upper bound on keep-alive clients (one WinHTTP session each) opened against a single host.
+		size_t maxConnectionsPerHost;
+		// Clients with nothing in flight for this long are closed on the next Acquire or EvictIdle.
+		std::chrono::seconds idleTimeout;
+		web::http::client::http_client_config clientConfig;
+	};
+
+	class ClientPool
+	{
+	public:
+		explicit ClientPool(const ClientPoolConfig& config = ClientPoolConfig());
+
+		// Leases the least loaded client for the endpoint's scheme, host and port. The client is
+		// returned to the pool when the last copy of the returned pointer is released, so callers
+		// keep it alive by capturing it in their request continuations.
+		std::shared_ptr<web::http::client::http_client> Acquire(const web::uri& endpoint);
+		size_t EvictIdle();
+		size_t Size() const;
+		const ClientPoolConfig& Config() const;
+
+	private:
+		struct Entry
+		{
+			std::shared_ptr<web::http::client::http_client> client;
+			std::atomic<size_t> inFlight;
+			std::atomic<long long> lastUsed;
+		};
+		typedef std::vector<std::shared_ptr<Entry>> Host;
+
+		static long long Now();
+		size_t EvictIdle(Host& host, long long now);
+
+		ClientPoolConfig m_config;
+		std::map<utility::string_t, Host> m_hosts;
+		mutable std::mutex m_lock;
+	};
+}
@@ -0,0 +1,10 @@
+#include "Hedge.h"
+
+using namespace QED;
+using namespace std;
+
+HedgeConfig::HedgeConfig()
+	: receives(false), sends(false), maxSendBytes(16 * 1024), percentile(0.95), minDelay(10), initialDelay(200),
+	minSamples(100), budgetRatio(0.05), budgetReserve(10), budgetMax(100)
+{
+}
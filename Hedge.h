@@ -0,0 +1,147 @@
+#pragma once
+#include <pplx/pplxtasks.h>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace QED
+{
+	struct HedgeConfig
+	{
+		HedgeConfig();
+
+		// Peek-lock receives may be hedged, and single-message sends up to maxSendBytes. Both are
+		// off by default; hedged sends carry one MessageId so a queue with duplicate detection
+		// keeps a single copy, and without it the message may be delivered twice.
+		bool receives;
+		bool sends;
+		size_t maxSendBytes;
+		// The duplicate goes out once the first attempt has taken longer than this percentile of
+		// the queue's recent total latency, but never sooner than minDelay.
+		double percentile;
+		std::chrono::milliseconds minDelay;
+		// Used until minSamples requests have been recorded.
+		std::chrono::milliseconds initialDelay;
+		size_t minSamples;
+		// Each request earns this fraction of a duplicate, capping the extra load hedging adds.
+		double budgetRatio;
+		size_t budgetReserve;
+		size_t budgetMax;
+	};
+
+	// Runs attempt, and runs it again once delay completes if the first is still outstanding and
+	// admit agrees. The first attempt to succeed completes the returned task and the other one's
+	// token is cancelled; a loser that succeeds anyway is handed to discard. A failure before the
+	// duplicate is sent is returned as is, otherwise the task fails only when both attempts have.
+	// finished runs once both attempts are over, after any discard. Cancelling token cancels both.
+	template <typename T>
+	pplx::task<T> Hedge(pplx::cancellation_token token, std::function<pplx::task<T>(pplx::cancellation_token)> attempt, pplx::task<void> delay,
+		std::function<bool()> admit, std::function<void(const T&)> discard, std::function<void()> finished)
+	{
+		struct State
+		{
+			State(pplx::cancellation_token token) : settled(false), pending(1)
+			{
+				if (token.is_cancelable())
+				{
+					sources[0] = pplx::cancellation_token_source::create_linked_source(token);
+					sources[1] = pplx::cancellation_token_source::create_linked_source(token);
+				}
+			}
+
+			std::mutex lock;
+			pplx::task_completion_event<T> result;
+			bool settled;
+			size_t pending;
+			std::exception_ptr error;
+			pplx::cancellation_token_source sources[2];
+		};
+		auto state = std::make_shared<State>(token);
+		auto launch = [state, attempt, discard, finished](size_t index)
+		{
+			pplx::task<T> started;
+			try
+			{
+				started = attempt(state->sources[index].get_token());
+			}
+			catch (...)
+			{
+				started = pplx::task_from_exception<T>(std::current_exception());
+			}
+			started.then([state, index, discard, finished](pplx::task<T> done)
+			{
+				T value;
+				std::exception_ptr error;
+				try
+				{
+					value = done.get();
+				}
+				catch (...)
+				{
+					error = std::current_exception();
+				}
+				bool won = false;
+				bool failed = false;
+				bool last;
+				{
+					std::lock_guard<std::mutex> guard(state->lock);
+					last = --state->pending == 0;
+					if (!state->settled && !error)
+					{
+						state->settled = won = true;
+					}
+					else if (!state->settled)
+					{
+						if (!state->error)
+						{
+							state->error = error;
+						}
+						// Settling now also stops a duplicate that has not been sent yet.
+						state->settled = failed = last;
+					}
+				}
+				if (won)
+				{
+					state->sources[1 - index].cancel();
+					state->result.set(value);
+				}
+				else if (failed)
+				{
+					state->result.set_exception(state->error);
+				}
+				else if (!error)
+				{
+					discard(value);
+				}
+				if (last)
+				{
+					finished();
+				}
+			});
+		};
+		launch(0);
+		delay.then([state, admit, launch](pplx::task<void> due)
+		{
+			try
+			{
+				due.get();
+			}
+			catch (const pplx::task_canceled&)
+			{
+				return;
+			}
+			{
+				std::lock_guard<std::mutex> guard(state->lock);
+				if (state->settled || !admit())
+				{
+					return;
+				}
+				++state->pending;
+			}
+			launch(1);
+		});
+		return pplx::create_task(state->result);
+	}
+}
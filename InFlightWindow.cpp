@@ -0,0 +1,104 @@
+#include "InFlightWindow.h"
+
+using namespace ::pplx;
+using namespace QED;
+using namespace std;
+
+InFlightWindow::InFlightWindow(size_t limit)
+	: m_limit(limit == 0 ? 1 : limit), m_inFlight(0)
+{
+}
+
+task<void> InFlightWindow::Acquire()
+{
+	lock_guard<mutex> guard(m_lock);
+	if (m_inFlight < m_limit)
+	{
+		++m_inFlight;
+		return task_from_result();
+	}
+	task_completion_event<void> slot;
+	m_waiters.push_back(slot);
+	return create_task(slot);
+}
+
+void InFlightWindow::Release()
+{
+	task_completion_event<void> next;
+	vector<task_completion_event<void>> idle;
+	bool handOff = false;
+	{
+		lock_guard<mutex> guard(m_lock);
+		if (!m_waiters.empty() && m_inFlight <= m_limit)
+		{
+			next = m_waiters.front();
+			m_waiters.pop_front();
+			handOff = true;
+		}
+		else
+		{
+			--m_inFlight;
+			if (m_inFlight == 0 && m_waiters.empty())
+			{
+				idle.swap(m_idle);
+			}
+		}
+	}
+	if (handOff)
+	{
+		next.set();
+	}
+	for (auto& waiter : idle)
+	{
+		waiter.set();
+	}
+}
+
+task<void> InFlightWindow::WhenIdle()
+{
+	lock_guard<mutex> guard(m_lock);
+	if (m_inFlight == 0 && m_waiters.empty())
+	{
+		return task_from_result();
+	}
+	task_completion_event<void> idle;
+	m_idle.push_back(idle);
+	return create_task(idle);
+}
+
+size_t InFlightWindow::InFlight() const
+{
+	lock_guard<mutex> guard(m_lock);
+	return m_inFlight;
+}
+
+size_t InFlightWindow::Waiting() const
+{
+	lock_guard<mutex> guard(m_lock);
+	return m_waiters.size();
+}
+
+size_t InFlightWindow::Limit() const
+{
+	lock_guard<mutex> guard(m_lock);
+	return m_limit;
+}
+
+void InFlightWindow::SetLimit(size_t limit)
+{
+	vector<task_completion_event<void>> admitted;
+	{
+		lock_guard<mutex> guard(m_lock);
+		m_limit = limit == 0 ? 1 : limit;
+		while (!m_waiters.empty() && m_inFlight < m_limit)
+		{
+			admitted.push_back(m_waiters.front());
+			m_waiters.pop_front();
+			++m_inFlight;
+		}
+	}
+	for (auto& waiter : admitted)
+	{
+		waiter.set();
+	}
+}
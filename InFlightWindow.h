@@ -0,0 +1,35 @@
+#pragma once
+#include <pplx/pplxtasks.h>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace QED
+{
+	// Bounds the number of outstanding operations. Acquire completes once a slot is free, so
+	// callers chain their request onto it instead of blocking a thread; every completed Acquire
+	// must be paired with exactly one Release.
+	class InFlightWindow
+	{
+	public:
+		explicit InFlightWindow(size_t limit);
+
+		pplx::task<void> Acquire();
+		void Release();
+		// Completes once nothing is in flight and nobody is waiting for a slot.
+		pplx::task<void> WhenIdle();
+		size_t InFlight() const;
+		size_t Waiting() const;
+		size_t Limit() const;
+		// Raising the limit admits waiters at once; lowering it lets in-flight work finish and only
+		// holds back new Acquires until the count is under the new limit.
+		void SetLimit(size_t limit);
+
+	private:
+		size_t m_limit;
+		size_t m_inFlight;
+		std::deque<pplx::task_completion_event<void>> m_waiters;
+		std::vector<pplx::task_completion_event<void>> m_idle;
+		mutable std::mutex m_lock;
+	};
+}
@@ -0,0 +1,349 @@
+#include "JsonDocument.h"
+#include <cpprest/json.h>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <new>
+
+using namespace web;
+using namespace QED;
+using namespace utility;
+using namespace std;
+
+namespace
+{
+	const size_t Alignment = 8;
+	// Chunks double in size up to this bound, so a large document needs only a few of them.
+	const size_t MaxChunkBytes = 4 * 1024 * 1024;
+
+	const JsonStringView EmptyView = { "", 0 };
+}
+
+JsonArena::JsonArena(size_t chunkBytes)
+	: m_offset(0), m_used(0), m_chunkBytes(chunkBytes < 1024 ? 1024 : chunkBytes)
+{
+}
+
+void* JsonArena::Allocate(size_t bytes)
+{
+	bytes = (bytes + Alignment - 1) & ~(Alignment - 1);
+	if (m_chunks.empty() || m_chunks.back().size - m_offset < bytes)
+	{
+		size_t size = m_chunks.empty() ? m_chunkBytes : (min)(m_chunks.back().size * 2, MaxChunkBytes);
+		Chunk chunk;
+		chunk.size = (max)(size, bytes);
+		chunk.data.reset(new uint8_t[chunk.size]);
+		m_chunks.push_back(std::move(chunk));
+		m_offset = 0;
+	}
+	void* result = m_chunks.back().data.get() + m_offset;
+	m_offset += bytes;
+	m_used += bytes;
+	return result;
+}
+
+const char* JsonArena::Copy(const char* data, size_t size)
+{
+	if (size == 0)
+	{
+		return "";
+	}
+	char* copy = static_cast<char*>(Allocate(size));
+	memcpy(copy, data, size);
+	return copy;
+}
+
+void JsonArena::Reset()
+{
+	if (m_chunks.size() > 1)
+	{
+		// Replace the chunks with one that would have held them all, so a same-sized document
+		// fits in a single chunk next time and a reused arena stops allocating.
+		Chunk merged;
+		merged.size = (min)(Reserved(), MaxChunkBytes);
+		merged.data.reset(new uint8_t[merged.size]);
+		m_chunks.clear();
+		m_chunks.push_back(std::move(merged));
+	}
+	m_offset = 0;
+	m_used = 0;
+}
+
+size_t JsonArena::Used() const
+{
+	return m_used;
+}
+
+size_t JsonArena::Reserved() const
+{
+	size_t reserved = 0;
+	for (auto& chunk : m_chunks)
+	{
+		reserved += chunk.size;
+	}
+	return reserved;
+}
+
+JsonNode::JsonNode()
+	: m_type(JsonType::Null), m_size(0), m_text(nullptr)
+{
+}
+
+JsonType JsonNode::Type() const
+{
+	return m_type;
+}
+
+bool JsonNode::IsNull() const
+{
+	return m_type == JsonType::Null;
+}
+
+bool JsonNode::AsBool() const
+{
+	if (m_type != JsonType::Boolean)
+	{
+		throw json::json_exception(L"not a boolean");
+	}
+	return m_boolean;
+}
+
+long long JsonNode::AsInt64() const
+{
+	if (m_type != JsonType::Number)
+	{
+		throw json::json_exception(L"not a number");
+	}
+	JsonStringView text = { m_text, m_size };
+	return text.IsInteger() ? text.ToInt64() : static_cast<long long>(text.ToDouble());
+}
+
+double JsonNode::AsDouble() const
+{
+	if (m_type != JsonType::Number)
+	{
+		throw json::json_exception(L"not a number");
+	}
+	JsonStringView text = { m_text, m_size };
+	return text.ToDouble();
+}
+
+JsonStringView JsonNode::AsString() const
+{
+	if (m_type != JsonType::String && m_type != JsonType::Number)
+	{
+		throw json::json_exception(L"not a string");
+	}
+	JsonStringView text = { m_text, m_size };
+	return text;
+}
+
+size_t JsonNode::Size() const
+{
+	return m_type == JsonType::Array || m_type == JsonType::Object ? m_size : 0;
+}
+
+const JsonNode& JsonNode::operator[](size_t index) const
+{
+	if (m_type != JsonType::Array)
+	{
+		throw json::json_exception(L"not an array");
+	}
+	if (index >= m_size)
+	{
+		throw json::json_exception(L"index out of bounds");
+	}
+	return m_elements[index];
+}
+
+const JsonMember& JsonNode::Member(size_t index) const
+{
+	if (m_type != JsonType::Object)
+	{
+		throw json::json_exception(L"not an object");
+	}
+	if (index >= m_size)
+	{
+		throw json::json_exception(L"index out of bounds");
+	}
+	return m_members[index];
+}
+
+const JsonNode* JsonNode::Find(const char* key) const
+{
+	if (m_type != JsonType::Object)
+	{
+		throw json::json_exception(L"not an object");
+	}
+	for (size_t i = 0; i < m_size; ++i)
+	{
+		if (m_members[i].key == key)
+		{
+			return &m_members[i].value;
+		}
+	}
+	return nullptr;
+}
+
+JsonDocument::JsonDocument(size_t chunkBytes)
+	: m_arena(chunkBytes), m_builder(*this), m_reader(m_builder)
+{
+}
+
+void JsonDocument::Parse(const uint8_t* data, size_t length)
+{
+	Clear();
+	Feed(data, length);
+	Finish();
+}
+
+void JsonDocument::Parse(const char* data, size_t length)
+{
+	Parse(reinterpret_cast<const uint8_t*>(data), length);
+}
+
+void JsonDocument::Feed(const uint8_t* data, size_t length)
+{
+	m_reader.Feed(data, length);
+}
+
+void JsonDocument::Finish()
+{
+	m_reader.Finish();
+}
+
+void JsonDocument::Clear()
+{
+	m_reader.Reset();
+	m_builder.Clear();
+	m_root = JsonNode();
+	m_arena.Reset();
+}
+
+const JsonNode& JsonDocument::Root() const
+{
+	return m_root;
+}
+
+const JsonArena& JsonDocument::Arena() const
+{
+	return m_arena;
+}
+
+JsonDocument::Builder::Builder(JsonDocument& document)
+	: m_document(document), m_key(EmptyView)
+{
+}
+
+bool JsonDocument::Builder::StartObject()
+{
+	Frame frame = { m_pending.size(), m_key };
+	m_frames.push_back(frame);
+	return true;
+}
+
+bool JsonDocument::Builder::Key(const JsonStringView& key)
+{
+	m_key.data = m_document.m_arena.Copy(key.data, key.size);
+	m_key.size = key.size;
+	return true;
+}
+
+bool JsonDocument::Builder::EndObject()
+{
+	return Add(End(JsonType::Object));
+}
+
+bool JsonDocument::Builder::StartArray()
+{
+	Frame frame = { m_pending.size(), m_key };
+	m_frames.push_back(frame);
+	return true;
+}
+
+bool JsonDocument::Builder::EndArray()
+{
+	return Add(End(JsonType::Array));
+}
+
+bool JsonDocument::Builder::String(const JsonStringView& text)
+{
+	JsonNode node;
+	node.m_type = JsonType::String;
+	node.m_text = m_document.m_arena.Copy(text.data, text.size);
+	node.m_size = text.size;
+	return Add(node);
+}
+
+bool JsonDocument::Builder::Number(const JsonStringView& text)
+{
+	JsonNode node;
+	node.m_type = JsonType::Number;
+	node.m_text = m_document.m_arena.Copy(text.data, text.size);
+	node.m_size = text.size;
+	return Add(node);
+}
+
+bool JsonDocument::Builder::Boolean(bool value)
+{
+	JsonNode node;
+	node.m_type = JsonType::Boolean;
+	node.m_boolean = value;
+	return Add(node);
+}
+
+bool JsonDocument::Builder::Null()
+{
+	return Add(JsonNode());
+}
+
+void JsonDocument::Builder::Clear()
+{
+	m_pending.clear();
+	m_frames.clear();
+	m_key = EmptyView;
+}
+
+bool JsonDocument::Builder::Add(const JsonNode& node)
+{
+	if (m_frames.empty())
+	{
+		m_document.m_root = node;
+		return true;
+	}
+	JsonMember member = { m_key, node };
+	m_pending.push_back(member);
+	m_key = EmptyView;
+	return true;
+}
+
+JsonNode JsonDocument::Builder::End(JsonType type)
+{
+	Frame frame = m_frames.back();
+	m_frames.pop_back();
+	size_t count = m_pending.size() - frame.start;
+	JsonNode node;
+	node.m_type = type;
+	node.m_size = count;
+	if (type == JsonType::Object)
+	{
+		JsonMember* members = static_cast<JsonMember*>(m_document.m_arena.Allocate(count * sizeof(JsonMember)));
+		for (size_t i = 0; i < count; ++i)
+		{
+			new (members + i) JsonMember(m_pending[frame.start + i]);
+		}
+		node.m_members = members;
+	}
+	else
+	{
+		JsonNode* elements = static_cast<JsonNode*>(m_document.m_arena.Allocate(count * sizeof(JsonNode)));
+		for (size_t i = 0; i < count; ++i)
+		{
+			new (elements + i) JsonNode(m_pending[frame.start + i].value);
+		}
+		node.m_elements = elements;
+	}
+	m_pending.erase(m_pending.begin() + frame.start, m_pending.end());
+	m_key = frame.key;
+	return node;
+}
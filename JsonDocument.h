@@ -0,0 +1,157 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "JsonReader.h"
+
+namespace QED
+{
+	// Monotonic allocator: allocation bumps a pointer through large chunks and nothing is freed
+	// individually. Reset drops everything at once and keeps a single chunk for the next use.
+	class JsonArena
+	{
+	public:
+		explicit JsonArena(size_t chunkBytes = 64 * 1024);
+
+		// 8-byte aligned, which covers every node type stored here.
+		void* Allocate(size_t bytes);
+		const char* Copy(const char* data, size_t size);
+		void Reset();
+		size_t Used() const;
+		size_t Reserved() const;
+
+	private:
+		struct Chunk
+		{
+			std::unique_ptr<uint8_t[]> data;
+			size_t size;
+		};
+
+		std::vector<Chunk> m_chunks;
+		size_t m_offset;
+		size_t m_used;
+		size_t m_chunkBytes;
+
+		JsonArena(const JsonArena&);
+		JsonArena& operator=(const JsonArena&);
+	};
+
+	enum class JsonType
+	{
+		Null,
+		Boolean,
+		Number,
+		String,
+		Array,
+		Object
+	};
+
+	struct JsonMember;
+
+	// Read-only node of a JsonDocument. Strings, keys and children all live in the document's
+	// arena, so nodes are only valid until the document is cleared or destroyed. Numbers keep
+	// their source text and are converted on access.
+	class JsonNode
+	{
+	public:
+		JsonNode();
+
+		JsonType Type() const;
+		bool IsNull() const;
+		bool AsBool() const;
+		long long AsInt64() const;
+		double AsDouble() const;
+		// The string's UTF-8 text, or a number's source text.
+		JsonStringView AsString() const;
+
+		// Element or member count of an array or object.
+		size_t Size() const;
+		const JsonNode& operator[](size_t index) const;
+		const JsonMember& Member(size_t index) const;
+		// Linear scan of an object's members; null when the key is missing.
+		const JsonNode* Find(const char* key) const;
+
+	private:
+		friend class JsonDocument;
+
+		JsonType m_type;
+		size_t m_size;
+		union
+		{
+			bool m_boolean;
+			const char* m_text;
+			const JsonNode* m_elements;
+			const JsonMember* m_members;
+		};
+	};
+
+	struct JsonMember
+	{
+		JsonStringView key;
+		JsonNode value;
+	};
+
+	// A parsed JSON tree whose every node, string and child array is carved from one arena, so a
+	// document costs a handful of chunk allocations however large it is, and dropping it is O(1).
+	// Clear keeps the arena's memory, so a document reused per message stops allocating.
+	class JsonDocument
+	{
+	public:
+		explicit JsonDocument(size_t chunkBytes = 64 * 1024);
+
+		// Clears the document and parses a complete body; malformed input throws json_exception.
+		void Parse(const uint8_t* data, size_t length);
+		void Parse(const char* data, size_t length);
+		// Incremental form: Clear, then Feed chunks, then Finish.
+		void Feed(const uint8_t* data, size_t length);
+		void Finish();
+		void Clear();
+
+		const JsonNode& Root() const;
+		const JsonArena& Arena() const;
+
+	private:
+		class Builder : public JsonHandler
+		{
+		public:
+			explicit Builder(JsonDocument& document);
+
+			bool StartObject();
+			bool Key(const JsonStringView&);
+			bool EndObject();
+			bool StartArray();
+			bool EndArray();
+			bool String(const JsonStringView&);
+			bool Number(const JsonStringView&);
+			bool Boolean(bool);
+			bool Null();
+
+			void Clear();
+
+		private:
+			struct Frame
+			{
+				size_t start;
+				JsonStringView key;
+			};
+
+			bool Add(const JsonNode& node);
+			JsonNode End(JsonType type);
+
+			JsonDocument& m_document;
+			// Children of the open containers, copied into the arena when their container closes.
+			std::vector<JsonMember> m_pending;
+			std::vector<Frame> m_frames;
+			JsonStringView m_key;
+		};
+
+		JsonArena m_arena;
+		JsonNode m_root;
+		Builder m_builder;
+		JsonReader m_reader;
+
+		JsonDocument(const JsonDocument&);
+		JsonDocument& operator=(const JsonDocument&);
+	};
+}
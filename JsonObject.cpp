@@ -0,0 +1,158 @@
+#include "JsonObject.h"
+#include <functional>
+
+using namespace web;
+using namespace QED;
+using namespace utility;
+using namespace std;
+
+const uint32_t JsonObject::Empty;
+
+JsonObject::JsonObject()
+{
+}
+
+JsonObject::JsonObject(json::value&& object)
+{
+	json::object& fields = object.as_object();
+	m_fields.reserve(fields.size());
+	for (auto& field : fields)
+	{
+		m_fields.push_back(make_pair(field.first, std::move(field.second)));
+	}
+	object = json::value::object();
+	if (m_fields.size() > IndexThreshold)
+	{
+		Rebuild(m_fields.size() * 2);
+	}
+}
+
+json::value& JsonObject::operator[](const string_t& key)
+{
+	size_t found = Lookup(key);
+	if (found != m_fields.size())
+	{
+		return m_fields[found].second;
+	}
+	m_fields.push_back(make_pair(key, json::value()));
+	if (!m_slots.empty())
+	{
+		Index(m_fields.size() - 1);
+	}
+	else if (m_fields.size() > IndexThreshold)
+	{
+		Rebuild(m_fields.size() * 2);
+	}
+	return m_fields.back().second;
+}
+
+json::value* JsonObject::Find(const string_t& key)
+{
+	size_t found = Lookup(key);
+	return found == m_fields.size() ? nullptr : &m_fields[found].second;
+}
+
+const json::value* JsonObject::Find(const string_t& key) const
+{
+	size_t found = Lookup(key);
+	return found == m_fields.size() ? nullptr : &m_fields[found].second;
+}
+
+bool JsonObject::Has(const string_t& key) const
+{
+	return Lookup(key) != m_fields.size();
+}
+
+size_t JsonObject::Size() const
+{
+	return m_fields.size();
+}
+
+void JsonObject::Reserve(size_t fields)
+{
+	m_fields.reserve(fields);
+}
+
+json::value JsonObject::ToValue(bool keepOrder)
+{
+	json::value result = json::value::object(std::move(m_fields), keepOrder);
+	m_fields.clear();
+	m_hashes.clear();
+	m_slots.clear();
+	return result;
+}
+
+size_t JsonObject::Lookup(const string_t& key) const
+{
+	if (m_slots.empty())
+	{
+		for (size_t i = 0; i < m_fields.size(); ++i)
+		{
+			if (m_fields[i].first == key)
+			{
+				return i;
+			}
+		}
+		return m_fields.size();
+	}
+	size_t hash = std::hash<string_t>()(key);
+	size_t mask = m_slots.size() - 1;
+	for (size_t slot = hash & mask;; slot = (slot + 1) & mask)
+	{
+		uint32_t entry = m_slots[slot];
+		if (entry == Empty)
+		{
+			return m_fields.size();
+		}
+		if (m_hashes[entry - 1] == hash && m_fields[entry - 1].first == key)
+		{
+			return entry - 1;
+		}
+	}
+}
+
+void JsonObject::Index(size_t field)
+{
+	// Keep the table at most half full so probe runs stay short.
+	if ((field + 1) * 2 > m_slots.size())
+	{
+		Rebuild(m_slots.size() * 2);
+		return;
+	}
+	size_t hash = std::hash<string_t>()(m_fields[field].first);
+	m_hashes.push_back(hash);
+	size_t mask = m_slots.size() - 1;
+	size_t slot = hash & mask;
+	while (m_slots[slot] != Empty)
+	{
+		slot = (slot + 1) & mask;
+	}
+	m_slots[slot] = static_cast<uint32_t>(field + 1);
+}
+
+void JsonObject::Rebuild(size_t slots)
+{
+	size_t capacity = 32;
+	while (capacity < slots)
+	{
+		capacity *= 2;
+	}
+	m_slots.assign(capacity, Empty);
+	size_t known = m_hashes.size();
+	m_hashes.resize(m_fields.size());
+	size_t mask = capacity - 1;
+	for (size_t i = 0; i < m_fields.size(); ++i)
+	{
+		if (i >= known)
+		{
+			m_hashes[i] = std::hash<string_t>()(m_fields[i].first);
+		}
+		size_t hash = m_hashes[i];
+		size_t slot = hash & mask;
+		while (m_slots[slot] != Empty)
+		{
+			slot = (slot + 1) & mask;
+		}
+		m_slots[slot] = static_cast<uint32_t>(i + 1);
+	}
+}
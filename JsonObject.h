@@ -0,0 +1,51 @@
+#pragma once
+#include <cpprest/json.h>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace QED
+{
+	// Insertion-ordered JSON object for building or reading large envelopes. Fields live in a vector;
+	// once there are more than IndexThreshold of them an open-addressing hash index over the keys is
+	// kept alongside, so access is O(1) and appending is O(1) amortized. Small objects are scanned
+	// linearly and never pay for the index.
+	//
+	// The index is maintained by the mutating members only, so like a standard container any number
+	// of threads may call the const members at once, but not while another thread modifies the object.
+	class JsonObject
+	{
+	public:
+		static const size_t IndexThreshold = 16;
+
+		JsonObject();
+		// Takes the fields of a json::value object, which is left empty.
+		explicit JsonObject(web::json::value&& object);
+
+		// Returns the field with this key, appending a null field if there is none.
+		web::json::value& operator[](const utility::string_t& key);
+		web::json::value* Find(const utility::string_t& key);
+		const web::json::value* Find(const utility::string_t& key) const;
+		bool Has(const utility::string_t& key) const;
+		size_t Size() const;
+		void Reserve(size_t fields);
+
+		// Moves the fields into a json::value, leaving this object empty. keepOrder skips the sort
+		// json::object would otherwise do and serializes fields in insertion order.
+		web::json::value ToValue(bool keepOrder = true);
+
+	private:
+		static const uint32_t Empty = 0;
+
+		size_t Lookup(const utility::string_t& key) const;
+		void Index(size_t field);
+		void Rebuild(size_t slots);
+
+		std::vector<std::pair<utility::string_t, web::json::value>> m_fields;
+		// Empty until the object outgrows IndexThreshold: hash of each key, and slots holding field
+		// index + 1 with 0 for empty.
+		std::vector<size_t> m_hashes;
+		std::vector<uint32_t> m_slots;
+	};
+}
@@ -0,0 +1,603 @@
+#include "JsonReader.h"
+#include <cpprest/json.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+using namespace ::pplx;
+using namespace web;
+using namespace QED;
+using namespace utility;
+using namespace std;
+using namespace Concurrency::streams;
+
+namespace
+{
+	bool IsSpace(uint8_t c)
+	{
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+	}
+
+	bool IsDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	bool IsNumberChar(uint8_t c)
+	{
+		return IsDigit(static_cast<char>(c)) || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+	}
+
+	int HexValue(uint8_t c)
+	{
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return -1;
+	}
+
+	// -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+	bool IsJsonNumber(const string& text)
+	{
+		size_t i = 0, n = text.size();
+		if (i < n && text[i] == '-') ++i;
+		if (i == n) return false;
+		if (text[i] == '0')
+		{
+			++i;
+		}
+		else
+		{
+			if (!IsDigit(text[i])) return false;
+			while (i < n && IsDigit(text[i])) ++i;
+		}
+		if (i < n && text[i] == '.')
+		{
+			if (++i == n || !IsDigit(text[i])) return false;
+			while (i < n && IsDigit(text[i])) ++i;
+		}
+		if (i < n && (text[i] == 'e' || text[i] == 'E'))
+		{
+			if (++i < n && (text[i] == '+' || text[i] == '-')) ++i;
+			if (i == n || !IsDigit(text[i])) return false;
+			while (i < n && IsDigit(text[i])) ++i;
+		}
+		return i == n;
+	}
+
+	task<bool> ReadChunks(Concurrency::streams::streambuf<uint8_t> source, shared_ptr<JsonReader> reader, shared_ptr<vector<uint8_t>> chunk)
+	{
+		return source.getn(chunk->data(), chunk->size()).then([source, reader, chunk](size_t read) -> task<bool>
+		{
+			if (read == 0)
+			{
+				return task_from_result(reader->Finish());
+			}
+			reader->Feed(chunk->data(), read);
+			if (reader->Stopped())
+			{
+				return task_from_result(false);
+			}
+			return ReadChunks(source, reader, chunk);
+		});
+	}
+}
+
+bool JsonStringView::operator==(const char* text) const
+{
+	return strlen(text) == size && memcmp(data, text, size) == 0;
+}
+
+bool JsonStringView::operator!=(const char* text) const
+{
+	return !(*this == text);
+}
+
+string JsonStringView::ToString() const
+{
+	return string(data, size);
+}
+
+bool JsonStringView::IsInteger() const
+{
+	return find_if(data, data + size, [](char c) { return c == '.' || c == 'e' || c == 'E'; }) == data + size;
+}
+
+long long JsonStringView::ToInt64() const
+{
+	return strtoll(ToString().c_str(), nullptr, 10);
+}
+
+double JsonStringView::ToDouble() const
+{
+	return strtod(ToString().c_str(), nullptr);
+}
+
+JsonReader::JsonReader(JsonHandler& handler)
+	: m_handler(handler), m_state(State::Value), m_key(false), m_direct(nullptr), m_unicode(0), m_unicodeDigits(0), m_highSurrogate(0),
+	m_literal(nullptr), m_literalMatched(0)
+{
+}
+
+void JsonReader::Feed(const uint8_t* data, size_t length)
+{
+	size_t i = 0;
+	while (i < length && m_state != State::Stopped)
+	{
+		uint8_t c = data[i];
+		switch (m_state)
+		{
+		case State::String:
+		{
+			// Skip the run of plain characters up to the next quote, escape or control character at once,
+			// checking UTF-8 only when the run actually contains non-ASCII bytes.
+			size_t start = i;
+			bool nonAscii = false;
+			i += ScanJsonString(data + i, length - i, nonAscii);
+			if ((nonAscii || !m_utf8.Complete()) && !m_utf8.Feed(data + start, i - start))
+			{
+				Fail(L"invalid UTF-8 in JSON string");
+			}
+			if (i > start)
+			{
+				if (m_direct == nullptr)
+				{
+					FlushSurrogate();
+					m_token.append(reinterpret_cast<const char*>(data + start), i - start);
+				}
+				continue;
+			}
+			++i;
+			if (!m_utf8.Complete())
+			{
+				Fail(L"invalid UTF-8 in JSON string");
+			}
+			if (c == '"')
+			{
+				EndString(data + i - 1);
+			}
+			else if (c == '\\')
+			{
+				if (m_direct != nullptr)
+				{
+					m_token.assign(reinterpret_cast<const char*>(m_direct), data + i - 1 - m_direct);
+					m_direct = nullptr;
+				}
+				m_state = State::Escape;
+			}
+			else
+			{
+				Fail(L"control character in JSON string");
+			}
+			break;
+		}
+		case State::Escape:
+			++i;
+			if (c == 'u')
+			{
+				m_unicode = 0;
+				m_unicodeDigits = 0;
+				m_state = State::Unicode;
+				break;
+			}
+			FlushSurrogate();
+			switch (c)
+			{
+			case '"': m_token.push_back('"'); break;
+			case '\\': m_token.push_back('\\'); break;
+			case '/': m_token.push_back('/'); break;
+			case 'b': m_token.push_back('\b'); break;
+			case 'f': m_token.push_back('\f'); break;
+			case 'n': m_token.push_back('\n'); break;
+			case 'r': m_token.push_back('\r'); break;
+			case 't': m_token.push_back('\t'); break;
+			default: Fail(L"invalid escape in JSON string");
+			}
+			m_state = State::String;
+			break;
+		case State::Unicode:
+		{
+			++i;
+			int digit = HexValue(c);
+			if (digit < 0)
+			{
+				Fail(L"invalid \\u escape in JSON string");
+			}
+			m_unicode = (m_unicode << 4) | static_cast<unsigned>(digit);
+			if (++m_unicodeDigits == 4)
+			{
+				EndUnicode();
+			}
+			break;
+		}
+		case State::Number:
+			if (IsNumberChar(c))
+			{
+				m_token.push_back(static_cast<char>(c));
+				++i;
+			}
+			else
+			{
+				// The terminator belongs to the enclosing state, so leave it to be read again.
+				EndNumber();
+			}
+			break;
+		case State::Literal:
+			++i;
+			if (static_cast<char>(c) != m_literal[m_literalMatched])
+			{
+				Fail(L"invalid JSON literal");
+			}
+			if (m_literal[++m_literalMatched] == '\0')
+			{
+				Emit(m_literal[0] == 'n' ? m_handler.Null() : m_handler.Boolean(m_literal[0] == 't'));
+			}
+			break;
+		default:
+			++i;
+			if (IsSpace(c))
+			{
+				break;
+			}
+			switch (m_state)
+			{
+			case State::Value:
+				BeginValue(data + i - 1);
+				break;
+			case State::FirstValueOrEnd:
+				if (c == ']')
+				{
+					m_stack.pop_back();
+					Emit(m_handler.EndArray());
+				}
+				else
+				{
+					BeginValue(data + i - 1);
+				}
+				break;
+			case State::FirstKeyOrEnd:
+			case State::Key:
+				if (c == '}' && m_state == State::FirstKeyOrEnd)
+				{
+					m_stack.pop_back();
+					Emit(m_handler.EndObject());
+				}
+				else if (c == '"')
+				{
+					BeginString(true, data + i);
+				}
+				else
+				{
+					Fail(L"expected a JSON object key");
+				}
+				break;
+			case State::Colon:
+				if (c != ':')
+				{
+					Fail(L"expected ':' after JSON object key");
+				}
+				m_state = State::Value;
+				break;
+			case State::CommaOrEnd:
+			{
+				bool object = m_stack.back();
+				if (c == ',')
+				{
+					m_state = object ? State::Key : State::Value;
+				}
+				else if (c == (object ? '}' : ']'))
+				{
+					m_stack.pop_back();
+					Emit(object ? m_handler.EndObject() : m_handler.EndArray());
+				}
+				else
+				{
+					Fail(L"expected ',' or the end of a JSON container");
+				}
+				break;
+			}
+			default:
+				Fail(L"unexpected data after the JSON document");
+			}
+		}
+	}
+	// The chunk is about to go away, so a string still open must move to the scratch buffer.
+	if (m_direct != nullptr)
+	{
+		m_token.assign(reinterpret_cast<const char*>(m_direct), data + length - m_direct);
+		m_direct = nullptr;
+	}
+}
+
+bool JsonReader::Finish()
+{
+	if (m_state == State::Number && m_stack.empty())
+	{
+		EndNumber();
+	}
+	bool stopped = m_state == State::Stopped;
+	if (!stopped && m_state != State::Done)
+	{
+		Fail(L"unexpected end of JSON input");
+	}
+	Reset();
+	return !stopped;
+}
+
+void JsonReader::Reset()
+{
+	m_state = State::Value;
+	m_direct = nullptr;
+	m_highSurrogate = 0;
+	m_utf8.Reset();
+	m_token.clear();
+	m_stack.clear();
+}
+
+bool JsonReader::Stopped() const
+{
+	return m_state == State::Stopped;
+}
+
+task<bool> JsonReader::ReadAsync(Concurrency::streams::streambuf<uint8_t> source, shared_ptr<JsonHandler> handler, size_t chunkBytes)
+{
+	auto reader = make_shared<JsonReader>(*handler);
+	auto chunk = make_shared<vector<uint8_t>>(chunkBytes == 0 ? 1 : chunkBytes);
+	return ReadChunks(source, reader, chunk).then([handler, reader](bool completed)
+	{
+		return completed;
+	});
+}
+
+void JsonReader::Fail(const char_t* message)
+{
+	throw json::json_exception(message);
+}
+
+void JsonReader::BeginValue(const uint8_t* position)
+{
+	uint8_t c = *position;
+	switch (c)
+	{
+	case '{':
+		m_stack.push_back(true);
+		m_state = m_handler.StartObject() ? State::FirstKeyOrEnd : State::Stopped;
+		break;
+	case '[':
+		m_stack.push_back(false);
+		m_state = m_handler.StartArray() ? State::FirstValueOrEnd : State::Stopped;
+		break;
+	case '"':
+		BeginString(false, position + 1);
+		break;
+	case 't':
+	case 'f':
+	case 'n':
+		m_literal = c == 't' ? "true" : c == 'f' ? "false" : "null";
+		m_literalMatched = 1;
+		m_state = State::Literal;
+		break;
+	default:
+		if (c != '-' && (c < '0' || c > '9'))
+		{
+			Fail(L"expected a JSON value");
+		}
+		m_token.assign(1, static_cast<char>(c));
+		m_state = State::Number;
+	}
+}
+
+void JsonReader::BeginString(bool key, const uint8_t* start)
+{
+	m_key = key;
+	m_token.clear();
+	m_utf8.Reset();
+	m_direct = start;
+	m_state = State::String;
+}
+
+void JsonReader::EndString(const uint8_t* end)
+{
+	FlushSurrogate();
+	JsonStringView text;
+	if (m_direct != nullptr)
+	{
+		text.data = reinterpret_cast<const char*>(m_direct);
+		text.size = end - m_direct;
+		m_direct = nullptr;
+	}
+	else
+	{
+		text.data = m_token.data();
+		text.size = m_token.size();
+	}
+	if (m_key)
+	{
+		m_state = m_handler.Key(text) ? State::Colon : State::Stopped;
+	}
+	else
+	{
+		Emit(m_handler.String(text));
+	}
+}
+
+void JsonReader::EndNumber()
+{
+	if (!IsJsonNumber(m_token))
+	{
+		Fail(L"invalid JSON number");
+	}
+	JsonStringView text = { m_token.data(), m_token.size() };
+	Emit(m_handler.Number(text));
+}
+
+void JsonReader::EndUnicode()
+{
+	m_state = State::String;
+	if (m_unicode >= 0xDC00 && m_unicode <= 0xDFFF && m_highSurrogate != 0)
+	{
+		AppendCodePoint(0x10000 + ((m_highSurrogate - 0xD800) << 10) + (m_unicode - 0xDC00));
+		m_highSurrogate = 0;
+		return;
+	}
+	FlushSurrogate();
+	if (m_unicode >= 0xD800 && m_unicode <= 0xDBFF)
+	{
+		m_highSurrogate = m_unicode;
+	}
+	else
+	{
+		// A lone low surrogate has no UTF-8 encoding.
+		AppendCodePoint(m_unicode >= 0xDC00 && m_unicode <= 0xDFFF ? 0xFFFD : m_unicode);
+	}
+}
+
+void JsonReader::FlushSurrogate()
+{
+	// A high surrogate not followed by its low half is replaced rather than rejected.
+	if (m_highSurrogate != 0)
+	{
+		m_highSurrogate = 0;
+		AppendCodePoint(0xFFFD);
+	}
+}
+
+void JsonReader::AppendCodePoint(unsigned codePoint)
+{
+	if (codePoint < 0x80)
+	{
+		m_token.push_back(static_cast<char>(codePoint));
+	}
+	else if (codePoint < 0x800)
+	{
+		m_token.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+		m_token.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+	}
+	else if (codePoint < 0x10000)
+	{
+		m_token.push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+		m_token.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+		m_token.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+	}
+	else
+	{
+		m_token.push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+		m_token.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+		m_token.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+		m_token.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+	}
+}
+
+void JsonReader::Emit(bool proceed)
+{
+	if (!proceed)
+	{
+		m_state = State::Stopped;
+	}
+	else
+	{
+		m_state = m_stack.empty() ? State::Done : State::CommaOrEnd;
+	}
+}
+
+JsonFields::JsonFields(vector<string> names)
+	: m_names(std::move(names)), m_remaining(0), m_depth(0), m_current(0)
+{
+	m_values.resize(m_names.size());
+	m_found.resize(m_names.size(), false);
+	m_remaining = m_names.size();
+	m_current = m_names.size();
+}
+
+bool JsonFields::Has(const string& name) const
+{
+	auto it = find(m_names.begin(), m_names.end(), name);
+	return it != m_names.end() && m_found[it - m_names.begin()];
+}
+
+const string& JsonFields::Get(const string& name) const
+{
+	auto it = find(m_names.begin(), m_names.end(), name);
+	if (it == m_names.end() || !m_found[it - m_names.begin()])
+	{
+		throw json::json_exception(L"Key not found");
+	}
+	return m_values[it - m_names.begin()];
+}
+
+bool JsonFields::StartObject()
+{
+	m_current = m_names.size();
+	++m_depth;
+	return true;
+}
+
+bool JsonFields::Key(const JsonStringView& key)
+{
+	m_current = m_names.size();
+	if (m_depth == 1)
+	{
+		for (size_t i = 0; i < m_names.size(); ++i)
+		{
+			if (!m_found[i] && key.size == m_names[i].size() && memcmp(key.data, m_names[i].data(), key.size) == 0)
+			{
+				m_current = i;
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+bool JsonFields::EndObject()
+{
+	--m_depth;
+	return true;
+}
+
+bool JsonFields::StartArray()
+{
+	m_current = m_names.size();
+	++m_depth;
+	return true;
+}
+
+bool JsonFields::EndArray()
+{
+	--m_depth;
+	return true;
+}
+
+bool JsonFields::String(const JsonStringView& value)
+{
+	return Capture(value);
+}
+
+bool JsonFields::Number(const JsonStringView& value)
+{
+	return Capture(value);
+}
+
+bool JsonFields::Boolean(bool value)
+{
+	JsonStringView text = { value ? "true" : "false", value ? 4u : 5u };
+	return Capture(text);
+}
+
+bool JsonFields::Null()
+{
+	JsonStringView text = { "null", 4 };
+	return Capture(text);
+}
+
+bool JsonFields::Capture(const JsonStringView& value)
+{
+	if (m_current == m_names.size())
+	{
+		return true;
+	}
+	m_values[m_current].assign(value.data, value.size);
+	m_found[m_current] = true;
+	m_current = m_names.size();
+	return --m_remaining > 0;
+}
@@ -0,0 +1,140 @@
+#pragma once
+#include <cpprest/streams.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "JsonScan.h"
+
+namespace QED
+{
+	// UTF-8 text handed to a JsonHandler. It points into the chunk being parsed, or into the reader's
+	// scratch buffer when the token had escapes or spanned chunks, so it is only valid during the call.
+	struct JsonStringView
+	{
+		const char* data;
+		size_t size;
+
+		bool operator==(const char* text) const;
+		bool operator!=(const char* text) const;
+		std::string ToString() const;
+		// Number tokens only; the reader has already checked them against the JSON grammar.
+		bool IsInteger() const;
+		long long ToInt64() const;
+		double ToDouble() const;
+	};
+
+	// Receives parse events in document order. Returning false from any event stops the parse
+	// without error, so a handler can quit as soon as it has what it needs.
+	class JsonHandler
+	{
+	public:
+		virtual ~JsonHandler() {}
+
+		virtual bool StartObject() { return true; }
+		virtual bool Key(const JsonStringView&) { return true; }
+		virtual bool EndObject() { return true; }
+		virtual bool StartArray() { return true; }
+		virtual bool EndArray() { return true; }
+		virtual bool String(const JsonStringView&) { return true; }
+		virtual bool Number(const JsonStringView&) { return true; }
+		virtual bool Boolean(bool) { return true; }
+		virtual bool Null() { return true; }
+	};
+
+	// Incremental SAX reader for UTF-8 JSON. Feed may be called with chunks split at any byte;
+	// nothing is allocated per node, only the scratch buffer for split or escaped tokens and the
+	// stack of open containers.
+	class JsonReader
+	{
+	public:
+		explicit JsonReader(JsonHandler& handler);
+
+		// Malformed input throws web::json::json_exception.
+		void Feed(const uint8_t* data, size_t length);
+		// Ends the input. Returns false if the handler stopped the parse early and throws if the
+		// document was incomplete.
+		bool Finish();
+		// Discards any partial document, e.g. after Feed threw, so the reader can start over.
+		void Reset();
+		bool Stopped() const;
+
+		// Reads the stream to its end, feeding each chunk as it completes; the handler is kept alive
+		// until the returned task finishes.
+		static pplx::task<bool> ReadAsync(Concurrency::streams::streambuf<uint8_t> source, std::shared_ptr<JsonHandler> handler, size_t chunkBytes = 16 * 1024);
+
+	private:
+		enum class State
+		{
+			Value,
+			FirstValueOrEnd,
+			FirstKeyOrEnd,
+			Key,
+			Colon,
+			CommaOrEnd,
+			String,
+			Escape,
+			Unicode,
+			Number,
+			Literal,
+			Done,
+			Stopped
+		};
+
+		static void Fail(const utility::char_t* message);
+		void BeginValue(const uint8_t* position);
+		void BeginString(bool key, const uint8_t* start);
+		void EndString(const uint8_t* end);
+		void EndNumber();
+		void EndUnicode();
+		void FlushSurrogate();
+		void AppendCodePoint(unsigned codePoint);
+		void Emit(bool proceed);
+
+		JsonHandler& m_handler;
+		State m_state;
+		bool m_key;
+		// Start of the current string within the chunk while it can still be handed out in place.
+		const uint8_t* m_direct;
+		std::string m_token;
+		Utf8Validator m_utf8;
+		unsigned m_unicode;
+		size_t m_unicodeDigits;
+		unsigned m_highSurrogate;
+		const char* m_literal;
+		size_t m_literalMatched;
+		// true for an open object, false for an open array.
+		std::vector<bool> m_stack;
+	};
+
+	// Collects the scalar values of selected top-level fields and stops once all have been seen.
+	// Only the matched values are copied; strings are decoded, numbers and literals kept as text.
+	class JsonFields : public JsonHandler
+	{
+	public:
+		explicit JsonFields(std::vector<std::string> names);
+
+		bool Has(const std::string& name) const;
+		const std::string& Get(const std::string& name) const;
+
+		bool StartObject();
+		bool Key(const JsonStringView&);
+		bool EndObject();
+		bool StartArray();
+		bool EndArray();
+		bool String(const JsonStringView&);
+		bool Number(const JsonStringView&);
+		bool Boolean(bool);
+		bool Null();
+
+	private:
+		bool Capture(const JsonStringView&);
+
+		std::vector<std::string> m_names;
+		std::vector<std::string> m_values;
+		std::vector<bool> m_found;
+		size_t m_remaining;
+		size_t m_depth;
+		size_t m_current;
+	};
+}
@@ -0,0 +1,348 @@
+#include "JsonScan.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define QED_TARGET_AVX2
+#define QED_TARGET_SSSE3
+#else
+#define QED_TARGET_AVX2 __attribute__((target("avx2")))
+#define QED_TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+#include <emmintrin.h>
+#include <immintrin.h>
+#include <tmmintrin.h>
+
+using namespace QED;
+
+namespace
+{
+	typedef size_t (*ScanFunction)(const uint8_t*, size_t, bool&);
+
+	unsigned LowestBit(unsigned mask)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return index;
+#else
+		return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+	}
+
+	size_t ScanScalar(const uint8_t* data, size_t length, bool& nonAscii)
+	{
+		for (size_t i = 0; i < length; ++i)
+		{
+			uint8_t c = data[i];
+			if (c == '"' || c == '\\' || c < 0x20)
+			{
+				return i;
+			}
+			if (c >= 0x80)
+			{
+				nonAscii = true;
+			}
+		}
+		return length;
+	}
+
+	// Bytes below 0x20 are found with a signed compare after flipping the top bit, since SSE2 has
+	// no unsigned byte compare.
+	size_t ScanSse2(const uint8_t* data, size_t length, bool& nonAscii)
+	{
+		const __m128i quote = _mm_set1_epi8('"');
+		const __m128i backslash = _mm_set1_epi8('\\');
+		const __m128i flip = _mm_set1_epi8(static_cast<char>(0x80));
+		const __m128i control = _mm_set1_epi8(static_cast<char>(0x20 ^ 0x80));
+		size_t i = 0;
+		for (; i + 16 <= length; i += 16)
+		{
+			__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+			__m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)),
+				_mm_cmplt_epi8(_mm_xor_si128(block, flip), control));
+			unsigned stops = static_cast<unsigned>(_mm_movemask_epi8(special));
+			unsigned high = static_cast<unsigned>(_mm_movemask_epi8(block));
+			if (stops != 0)
+			{
+				unsigned at = LowestBit(stops);
+				if ((high & ((1u << at) - 1)) != 0)
+				{
+					nonAscii = true;
+				}
+				return i + at;
+			}
+			if (high != 0)
+			{
+				nonAscii = true;
+			}
+		}
+		return i + ScanScalar(data + i, length - i, nonAscii);
+	}
+
+	QED_TARGET_AVX2 size_t ScanAvx2(const uint8_t* data, size_t length, bool& nonAscii)
+	{
+		const __m256i quote = _mm256_set1_epi8('"');
+		const __m256i backslash = _mm256_set1_epi8('\\');
+		const __m256i flip = _mm256_set1_epi8(static_cast<char>(0x80));
+		const __m256i control = _mm256_set1_epi8(static_cast<char>(0x20 ^ 0x80));
+		size_t i = 0;
+		for (; i + 32 <= length; i += 32)
+		{
+			__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+			__m256i special = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, quote), _mm256_cmpeq_epi8(block, backslash)),
+				_mm256_cmpgt_epi8(control, _mm256_xor_si256(block, flip)));
+			unsigned stops = static_cast<unsigned>(_mm256_movemask_epi8(special));
+			unsigned high = static_cast<unsigned>(_mm256_movemask_epi8(block));
+			if (stops != 0)
+			{
+				unsigned at = LowestBit(stops);
+				if ((high & ((1u << at) - 1)) != 0)
+				{
+					nonAscii = true;
+				}
+				return i + at;
+			}
+			if (high != 0)
+			{
+				nonAscii = true;
+			}
+		}
+		return i + ScanSse2(data + i, length - i, nonAscii);
+	}
+
+	bool HasAvx2()
+	{
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+		{
+			return false;
+		}
+		__cpuid(info, 1);
+		// The OS must save the YMM registers (OSXSAVE and XCR0 bits 1-2) for AVX to be usable.
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		if (!osxsave || (_xgetbv(0) & 6) != 6)
+		{
+			return false;
+		}
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		return __builtin_cpu_supports("avx2") != 0;
+#endif
+	}
+
+	// Chosen once during static initialization, before any parse can run.
+	const ScanFunction Scan = HasAvx2() ? ScanAvx2 : ScanSse2;
+
+	// Error classes of a byte and the one before it, one bit each, for the lookup validator below.
+	const uint8_t TooShort = 1 << 0;
+	const uint8_t TooLong = 1 << 1;
+	const uint8_t Overlong3 = 1 << 2;
+	const uint8_t TooLarge = 1 << 3;
+	const uint8_t Surrogate = 1 << 4;
+	const uint8_t Overlong2 = 1 << 5;
+	const uint8_t TooLarge1000 = 1 << 6;
+	const uint8_t Overlong4 = 1 << 6;
+	const uint8_t TwoConts = 1 << 7;
+	const uint8_t Carry = TooShort | TooLong | TwoConts;
+
+	// Indexed by the high nibble of the previous byte.
+	const uint8_t Byte1High[16] =
+	{
+		TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong,
+		TwoConts, TwoConts, TwoConts, TwoConts,
+		TooShort | Overlong2,
+		TooShort,
+		TooShort | Overlong3 | Surrogate,
+		TooShort | TooLarge | TooLarge1000 | Overlong4
+	};
+
+	// Indexed by the low nibble of the previous byte.
+	const uint8_t Byte1Low[16] =
+	{
+		Carry | Overlong3 | Overlong2 | Overlong4,
+		Carry | Overlong2,
+		Carry,
+		Carry,
+		Carry | TooLarge,
+		Carry | TooLarge | TooLarge1000,
+		Carry | TooLarge | TooLarge1000,
+		Carry | TooLarge | TooLarge1000,
+		Carry | TooLarge | TooLarge1000,
+		Carry | TooLarge | TooLarge1000,
+		Carry | TooLarge | TooLarge1000,
+		Carry | TooLarge | TooLarge1000,
+		Carry | TooLarge | TooLarge1000,
+		Carry | TooLarge | TooLarge1000 | Surrogate,
+		Carry | TooLarge | TooLarge1000,
+		Carry | TooLarge | TooLarge1000
+	};
+
+	// Indexed by the high nibble of the byte itself.
+	const uint8_t Byte2High[16] =
+	{
+		TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort,
+		TooLong | Overlong2 | TwoConts | Overlong3 | TooLarge1000 | Overlong4,
+		TooLong | Overlong2 | TwoConts | Overlong3 | TooLarge,
+		TooLong | Overlong2 | TwoConts | Surrogate | TooLarge,
+		TooLong | Overlong2 | TwoConts | Surrogate | TooLarge,
+		TooShort, TooShort, TooShort, TooShort
+	};
+
+	// Validates whole 16-byte blocks (after Keiser and Lemire's lookup validator): three pshufb
+	// lookups on the nibbles of each byte and of the byte before it flag every invalid pair, and
+	// the bytes two and three back say where a third or fourth continuation is due, which the
+	// pair tables expect to see as TwoConts. Starts on a character boundary and sets consumed to
+	// the boundary before any character cut off at the end of the last block.
+	QED_TARGET_SSSE3 bool ValidateSsse3(const uint8_t* data, size_t length, size_t& consumed)
+	{
+		const __m128i lowNibble = _mm_set1_epi8(0x0F);
+		const __m128i byte1High = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Byte1High));
+		const __m128i byte1Low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Byte1Low));
+		const __m128i byte2High = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Byte2High));
+		const __m128i thirdByte = _mm_set1_epi8(static_cast<char>(0xE0 - 1));
+		const __m128i fourthByte = _mm_set1_epi8(static_cast<char>(0xF0 - 1));
+		const __m128i high = _mm_set1_epi8(static_cast<char>(0x80));
+		const __m128i zero = _mm_setzero_si128();
+		__m128i previous = zero;
+		__m128i error = zero;
+		bool previousAscii = true;
+		size_t i = 0;
+		for (; i + 16 <= length; i += 16)
+		{
+			__m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+			bool ascii = _mm_movemask_epi8(input) == 0;
+			if (ascii && previousAscii)
+			{
+				previous = input;
+				continue;
+			}
+			previousAscii = ascii;
+			__m128i prev1 = _mm_alignr_epi8(input, previous, 15);
+			__m128i special = _mm_and_si128(_mm_and_si128(
+				_mm_shuffle_epi8(byte1High, _mm_and_si128(_mm_srli_epi16(prev1, 4), lowNibble)),
+				_mm_shuffle_epi8(byte1Low, _mm_and_si128(prev1, lowNibble))),
+				_mm_shuffle_epi8(byte2High, _mm_and_si128(_mm_srli_epi16(input, 4), lowNibble)));
+			__m128i continued = _mm_or_si128(_mm_subs_epu8(_mm_alignr_epi8(input, previous, 14), thirdByte),
+				_mm_subs_epu8(_mm_alignr_epi8(input, previous, 13), fourthByte));
+			__m128i expected = _mm_andnot_si128(_mm_cmpeq_epi8(continued, zero), high);
+			error = _mm_or_si128(error, _mm_xor_si128(expected, special));
+			previous = input;
+		}
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, zero)) != 0xFFFF)
+		{
+			return false;
+		}
+		// Errors were only checked for bytes inside the blocks, so a lead byte in the last three
+		// whose sequence runs past them is left for the byte loop.
+		consumed = i;
+		for (size_t back = 1; back <= 3 && back <= i; ++back)
+		{
+			uint8_t c = data[i - back];
+			if ((c & 0xC0) != 0x80)
+			{
+				size_t size = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+				if (size > back)
+				{
+					consumed = i - back;
+				}
+				break;
+			}
+		}
+		return true;
+	}
+
+	bool HasSsse3()
+	{
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 9)) != 0;
+#else
+		return __builtin_cpu_supports("ssse3") != 0;
+#endif
+	}
+
+	const bool UseSsse3 = HasSsse3();
+}
+
+size_t QED::ScanJsonString(const uint8_t* data, size_t length, bool& nonAscii)
+{
+	return Scan(data, length, nonAscii);
+}
+
+Utf8Validator::Utf8Validator()
+	: m_need(0), m_lower(0x80), m_upper(0xBF)
+{
+}
+
+bool Utf8Validator::Feed(const uint8_t* data, size_t length)
+{
+	size_t i = 0;
+	// The block check has to start on a character boundary, so finish any character carried over
+	// from the previous call first.
+	for (; i < length && m_need != 0; ++i)
+	{
+		if (!Step(data[i]))
+		{
+			return false;
+		}
+	}
+	if (UseSsse3 && length - i >= 16)
+	{
+		size_t consumed;
+		if (!ValidateSsse3(data + i, length - i, consumed))
+		{
+			return false;
+		}
+		i += consumed;
+	}
+	for (; i < length; ++i)
+	{
+		if (!Step(data[i]))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Utf8Validator::Complete() const
+{
+	return m_need == 0;
+}
+
+void Utf8Validator::Reset()
+{
+	m_need = 0;
+	m_lower = 0x80;
+	m_upper = 0xBF;
+}
+
+bool Utf8Validator::Step(uint8_t c)
+{
+	if (m_need != 0)
+	{
+		if (c < m_lower || c > m_upper)
+		{
+			return false;
+		}
+		--m_need;
+		m_lower = 0x80;
+		m_upper = 0xBF;
+	}
+	else if (c >= 0x80)
+	{
+		// The second byte's range is what rules out overlong forms, surrogates and values past U+10FFFF.
+		if (c >= 0xC2 && c <= 0xDF) m_need = 1;
+		else if (c == 0xE0) { m_need = 2; m_lower = 0xA0; }
+		else if (c == 0xED) { m_need = 2; m_upper = 0x9F; }
+		else if (c >= 0xE1 && c <= 0xEF) m_need = 2;
+		else if (c == 0xF0) { m_need = 3; m_lower = 0x90; }
+		else if (c == 0xF4) { m_need = 3; m_upper = 0x8F; }
+		else if (c >= 0xF1 && c <= 0xF3) m_need = 3;
+		else return false;
+	}
+	return true;
+}
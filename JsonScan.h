@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace QED
+{
+	// Returns the offset of the first quote, backslash or control character in the block, or length
+	// if there is none. nonAscii is set when a byte >= 0x80 precedes that point. Scans 32 bytes at
+	// a time with AVX2 or 16 with SSE2, whichever the CPU supports, and falls back to a byte loop.
+	size_t ScanJsonString(const uint8_t* data, size_t length, bool& nonAscii);
+
+	// Incremental UTF-8 check that accepts input split anywhere, rejecting overlong forms,
+	// surrogates and code points past U+10FFFF. Checks 16 bytes at a time with SSSE3; a character
+	// split between calls is finished byte by byte.
+	class Utf8Validator
+	{
+	public:
+		Utf8Validator();
+
+		// Returns false once the input seen so far is invalid.
+		bool Feed(const uint8_t* data, size_t length);
+		// True when the input ends on a character boundary.
+		bool Complete() const;
+		void Reset();
+
+	private:
+		bool Step(uint8_t c);
+
+		unsigned m_need;
+		uint8_t m_lower;
+		uint8_t m_upper;
+	};
+}
@@ -0,0 +1,123 @@
+#include "JsonStreamParser.h"
+#include <limits>
+#include <memory>
+#include "Utf.h"
+
+using namespace ::pplx;
+using namespace web;
+using namespace QED;
+using namespace utility;
+using namespace std;
+using namespace Concurrency::streams;
+
+JsonStreamParser::JsonStreamParser()
+	: m_reader(m_builder)
+{
+}
+
+void JsonStreamParser::Feed(const uint8_t* data, size_t length)
+{
+	m_reader.Feed(data, length);
+}
+
+json::value JsonStreamParser::Finish()
+{
+	m_reader.Finish();
+	return m_builder.Take();
+}
+
+task<json::value> JsonStreamParser::ParseAsync(Concurrency::streams::streambuf<uint8_t> source, size_t chunkBytes)
+{
+	auto builder = make_shared<Builder>();
+	return JsonReader::ReadAsync(source, builder, chunkBytes).then([builder](bool)
+	{
+		return builder->Take();
+	});
+}
+
+bool JsonStreamParser::Builder::StartObject()
+{
+	m_stack.push_back(Frame());
+	m_stack.back().object = true;
+	return true;
+}
+
+bool JsonStreamParser::Builder::Key(const JsonStringView& key)
+{
+	m_stack.back().key = ToStringT(key.data, key.size);
+	return true;
+}
+
+bool JsonStreamParser::Builder::EndObject()
+{
+	json::value value = json::value::object(std::move(m_stack.back().fields));
+	m_stack.pop_back();
+	return Add(std::move(value));
+}
+
+bool JsonStreamParser::Builder::StartArray()
+{
+	m_stack.push_back(Frame());
+	m_stack.back().object = false;
+	return true;
+}
+
+bool JsonStreamParser::Builder::EndArray()
+{
+	json::value value = json::value::array(std::move(m_stack.back().elements));
+	m_stack.pop_back();
+	return Add(std::move(value));
+}
+
+bool JsonStreamParser::Builder::String(const JsonStringView& text)
+{
+	return Add(json::value::string(ToStringT(text.data, text.size)));
+}
+
+bool JsonStreamParser::Builder::Number(const JsonStringView& text)
+{
+	if (text.IsInteger())
+	{
+		long long parsed = text.ToInt64();
+		if (parsed >= (numeric_limits<int32_t>::min)() && parsed <= (numeric_limits<int32_t>::max)())
+		{
+			return Add(json::value::number(static_cast<int32_t>(parsed)));
+		}
+	}
+	return Add(json::value::number(text.ToDouble()));
+}
+
+bool JsonStreamParser::Builder::Boolean(bool value)
+{
+	return Add(json::value::boolean(value));
+}
+
+bool JsonStreamParser::Builder::Null()
+{
+	return Add(json::value::null());
+}
+
+json::value JsonStreamParser::Builder::Take()
+{
+	m_stack.clear();
+	return std::move(m_root);
+}
+
+bool JsonStreamParser::Builder::Add(json::value value)
+{
+	if (m_stack.empty())
+	{
+		m_root = std::move(value);
+		return true;
+	}
+	Frame& top = m_stack.back();
+	if (top.object)
+	{
+		top.fields.push_back(make_pair(std::move(top.key), std::move(value)));
+	}
+	else
+	{
+		top.elements.push_back(std::move(value));
+	}
+	return true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <cpprest/json.h>
+#include <cpprest/streams.h>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "JsonReader.h"
+
+namespace QED
+{
+	// Push parser for UTF-8 JSON text that arrives in pieces. Each Feed consumes one chunk and keeps
+	// only the partial token and the open containers, so parsing overlaps the network receive and
+	// the raw body never has to be held in full. Builds a json::value; handlers that only need a
+	// few fields should drive a JsonReader directly instead.
+	class JsonStreamParser
+	{
+	public:
+		JsonStreamParser();
+
+		// Malformed input throws web::json::json_exception.
+		void Feed(const uint8_t* data, size_t length);
+		// Ends the input and returns the document; throws if it was incomplete.
+		web::json::value Finish();
+
+		// Reads the stream to its end, feeding each chunk to a parser as it completes.
+		static pplx::task<web::json::value> ParseAsync(Concurrency::streams::streambuf<uint8_t> source, size_t chunkBytes = 16 * 1024);
+
+	private:
+		class Builder : public JsonHandler
+		{
+		public:
+			bool StartObject();
+			bool Key(const JsonStringView&);
+			bool EndObject();
+			bool StartArray();
+			bool EndArray();
+			bool String(const JsonStringView&);
+			bool Number(const JsonStringView&);
+			bool Boolean(bool);
+			bool Null();
+
+			web::json::value Take();
+
+		private:
+			struct Frame
+			{
+				bool object;
+				utility::string_t key;
+				std::vector<std::pair<utility::string_t, web::json::value>> fields;
+				std::vector<web::json::value> elements;
+			};
+
+			bool Add(web::json::value value);
+
+			std::vector<Frame> m_stack;
+			web::json::value m_root;
+		};
+
+		Builder m_builder;
+		JsonReader m_reader;
+
+		JsonStreamParser(const JsonStreamParser&);
+		JsonStreamParser& operator=(const JsonStreamParser&);
+	};
+}
@@ -0,0 +1,219 @@
+#include "JsonWriter.h"
+#include "JsonScan.h"
+#include "Utf.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace web;
+using namespace QED;
+using namespace utility;
+using namespace std;
+
+namespace
+{
+	const char Hex[] = "0123456789abcdef";
+
+	// Escape needed for this byte, or 0 to copy it as is.
+	char EscapeFor(uint8_t c)
+	{
+		switch (c)
+		{
+		case '"': return '"';
+		case '\\': return '\\';
+		case '\b': return 'b';
+		case '\f': return 'f';
+		case '\n': return 'n';
+		case '\r': return 'r';
+		case '\t': return 't';
+		default: return c < 0x20 ? 'u' : 0;
+		}
+	}
+
+	void AppendEscape(char escape, uint8_t c, string& out)
+	{
+		out.push_back('\\');
+		out.push_back(escape);
+		if (escape == 'u')
+		{
+			out.append("00");
+			out.push_back(Hex[c >> 4]);
+			out.push_back(Hex[c & 0xF]);
+		}
+	}
+
+	void AppendUnsigned(unsigned long long value, string& out)
+	{
+		char digits[20];
+		size_t count = 0;
+		do
+		{
+			digits[count++] = static_cast<char>('0' + value % 10);
+			value /= 10;
+		} while (value != 0);
+		while (count > 0)
+		{
+			out.push_back(digits[--count]);
+		}
+	}
+
+	void AppendSigned(long long value, string& out)
+	{
+		if (value < 0)
+		{
+			out.push_back('-');
+			// Negate in unsigned arithmetic so the minimum value does not overflow.
+			AppendUnsigned(0ull - static_cast<unsigned long long>(value), out);
+		}
+		else
+		{
+			AppendUnsigned(static_cast<unsigned long long>(value), out);
+		}
+	}
+
+	void AppendDouble(double value, string& out)
+	{
+		if (value != value || value - value != 0)
+		{
+			// NaN and infinity have no JSON form.
+			out.append("null");
+			return;
+		}
+		// Whole numbers inside the exactly representable range print as integers, without printf.
+		if (value == floor(value) && fabs(value) < 9007199254740992.0)
+		{
+			AppendSigned(static_cast<long long>(value), out);
+			return;
+		}
+		// Shortest of 15 or 17 significant digits that reads back to the same double.
+		char text[32];
+		int length = sprintf_s(text, sizeof(text), "%.15g", value);
+		if (strtod(text, nullptr) != value)
+		{
+			length = sprintf_s(text, sizeof(text), "%.17g", value);
+		}
+		out.append(text, length);
+	}
+}
+
+void JsonWriter::Write(const json::value& value, string& out)
+{
+	switch (value.type())
+	{
+	case json::value::Null:
+		out.append("null");
+		break;
+	case json::value::Boolean:
+		out.append(value.as_bool() ? "true" : "false");
+		break;
+	case json::value::Number:
+		WriteNumber(value.as_number(), out);
+		break;
+	case json::value::String:
+		WriteString(value.as_string(), out);
+		break;
+	case json::value::Array:
+	{
+		out.push_back('[');
+		bool first = true;
+		for (auto& element : value.as_array())
+		{
+			if (!first)
+			{
+				out.push_back(',');
+			}
+			first = false;
+			Write(element, out);
+		}
+		out.push_back(']');
+		break;
+	}
+	case json::value::Object:
+	{
+		out.push_back('{');
+		bool first = true;
+		for (auto& field : value.as_object())
+		{
+			if (!first)
+			{
+				out.push_back(',');
+			}
+			first = false;
+			WriteString(field.first, out);
+			out.push_back(':');
+			Write(field.second, out);
+		}
+		out.push_back('}');
+		break;
+	}
+	}
+}
+
+void JsonWriter::WriteString(const string& utf8, string& out)
+{
+	WriteString(utf8.data(), utf8.size(), out);
+}
+
+void JsonWriter::WriteString(const char* utf8, size_t length, string& out)
+{
+	const uint8_t* data = reinterpret_cast<const uint8_t*>(utf8);
+	out.reserve(out.size() + length + 2);
+	out.push_back('"');
+	size_t start = 0;
+	while (start < length)
+	{
+		// Copy the run up to the next character that needs escaping in one append.
+		bool nonAscii = false;
+		size_t run = ScanJsonString(data + start, length - start, nonAscii);
+		out.append(utf8 + start, run);
+		start += run;
+		if (start < length)
+		{
+			AppendEscape(EscapeFor(data[start]), data[start], out);
+			++start;
+		}
+	}
+	out.push_back('"');
+}
+
+void JsonWriter::WriteString(const utf16string& utf16, string& out)
+{
+	// Transcode straight into out, and only go back to escape when the text turns out to need it.
+	out.push_back('"');
+	size_t start = out.size();
+	AppendUtf8(utf16.data(), utf16.size(), out);
+	size_t length = out.size() - start;
+	bool nonAscii = false;
+	if (ScanJsonString(reinterpret_cast<const uint8_t*>(out.data() + start), length, nonAscii) == length)
+	{
+		out.push_back('"');
+		return;
+	}
+	string text(out, start);
+	out.resize(start - 1);
+	WriteString(text, out);
+}
+
+void JsonWriter::WriteNumber(const json::number& number, string& out)
+{
+	if (!number.is_integral())
+	{
+		AppendDouble(number.to_double(), out);
+	}
+	else if (number.is_int64())
+	{
+		AppendSigned(number.to_int64(), out);
+	}
+	else
+	{
+		AppendUnsigned(number.to_uint64(), out);
+	}
+}
+
+string JsonWriter::Serialize(const json::value& value)
+{
+	string out;
+	Write(value, out);
+	return out;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <cpprest/json.h>
+#include <string>
+
+namespace QED
+{
+	// Serializes json::value straight to UTF-8. On Windows string_t is UTF-16, so serialize()
+	// builds a wide string that then has to be transcoded and copied again before it can be sent;
+	// this walks the value once and transcodes each string as it is written.
+	class JsonWriter
+	{
+	public:
+		// Append to out without clearing it, so callers can reuse one buffer across messages.
+		static void Write(const web::json::value& value, std::string& out);
+		// Quoted and escaped JSON string from UTF-8 or UTF-16 text.
+		static void WriteString(const std::string& utf8, std::string& out);
+		static void WriteString(const char* utf8, size_t length, std::string& out);
+		static void WriteString(const utf16string& utf16, std::string& out);
+		static void WriteNumber(const web::json::number& number, std::string& out);
+
+		static std::string Serialize(const web::json::value& value);
+	};
+}
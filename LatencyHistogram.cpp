@@ -0,0 +1,158 @@
+#include "LatencyHistogram.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+using namespace QED;
+using namespace std;
+
+namespace
+{
+	unsigned HighestBit(unsigned long long value)
+	{
+#if defined(_MSC_VER)
+		// _BitScanReverse64 is x64 only, so search the two halves.
+		unsigned long index;
+		if (_BitScanReverse(&index, static_cast<unsigned long>(value >> 32)))
+		{
+			return index + 32;
+		}
+		_BitScanReverse(&index, static_cast<unsigned long>(value));
+		return index;
+#else
+		return 63 - static_cast<unsigned>(__builtin_clzll(value));
+#endif
+	}
+}
+
+LatencySnapshot::LatencySnapshot()
+	: count(0), sum(0), max(0)
+{
+}
+
+double LatencySnapshot::Percentile(double p) const
+{
+	if (count == 0)
+	{
+		return 0;
+	}
+	unsigned long long rank = static_cast<unsigned long long>(p * count + 0.5);
+	rank = rank < 1 ? 1 : rank > count ? count : rank;
+	unsigned long long seen = 0;
+	for (size_t i = 0; i < buckets.size(); ++i)
+	{
+		seen += buckets[i];
+		if (seen >= rank)
+		{
+			unsigned long long value = LatencyHistogram::BucketValue(i);
+			return static_cast<double>(value < max ? value : max);
+		}
+	}
+	return static_cast<double>(max);
+}
+
+double LatencySnapshot::Mean() const
+{
+	return count == 0 ? 0 : static_cast<double>(sum) / count;
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+	Reset();
+}
+
+void LatencyHistogram::Record(chrono::microseconds elapsed)
+{
+	unsigned long long micros = elapsed.count() > 0 ? static_cast<unsigned long long>(elapsed.count()) : 0;
+	m_buckets[BucketFor(micros)].fetch_add(1, memory_order_relaxed);
+	m_sum.fetch_add(micros, memory_order_relaxed);
+	unsigned long long max = m_max.load(memory_order_relaxed);
+	while (micros > max && !m_max.compare_exchange_weak(max, micros, memory_order_relaxed))
+	{
+	}
+}
+
+LatencySnapshot LatencyHistogram::Snapshot() const
+{
+	LatencySnapshot snapshot;
+	snapshot.buckets.resize(Buckets);
+	for (size_t i = 0; i < Buckets; ++i)
+	{
+		snapshot.buckets[i] = m_buckets[i].load(memory_order_relaxed);
+		snapshot.count += snapshot.buckets[i];
+	}
+	// The count is summed from the copied buckets so percentiles stay consistent with them.
+	snapshot.sum = m_sum.load(memory_order_relaxed);
+	snapshot.max = m_max.load(memory_order_relaxed);
+	return snapshot;
+}
+
+void LatencyHistogram::Reset()
+{
+	for (size_t i = 0; i < Buckets; ++i)
+	{
+		m_buckets[i].store(0, memory_order_relaxed);
+	}
+	m_sum.store(0, memory_order_relaxed);
+	m_max.store(0, memory_order_relaxed);
+}
+
+size_t LatencyHistogram::BucketFor(unsigned long long micros)
+{
+	const unsigned long long linear = 1ull << SubBucketBits;
+	if (micros < linear)
+	{
+		return static_cast<size_t>(micros);
+	}
+	unsigned exponent = HighestBit(micros);
+	if (exponent > MaxExponent)
+	{
+		return Buckets - 1;
+	}
+	size_t shift = exponent - SubBucketBits;
+	return ((exponent - SubBucketBits + 1) << SubBucketBits) + static_cast<size_t>((micros >> shift) & (linear - 1));
+}
+
+unsigned long long LatencyHistogram::BucketValue(size_t bucket)
+{
+	const size_t linear = 1 << SubBucketBits;
+	if (bucket < linear)
+	{
+		return bucket;
+	}
+	size_t shift = (bucket >> SubBucketBits) - 1;
+	unsigned long long low = static_cast<unsigned long long>(linear + (bucket & (linear - 1))) << shift;
+	return low + ((1ull << shift) >> 1);
+}
+
+void LatencyMetrics::Record(LatencyPhase phase, chrono::steady_clock::duration elapsed)
+{
+	m_phases[static_cast<size_t>(phase)].Record(chrono::duration_cast<chrono::microseconds>(elapsed));
+}
+
+LatencySnapshot LatencyMetrics::Snapshot(LatencyPhase phase) const
+{
+	return m_phases[static_cast<size_t>(phase)].Snapshot();
+}
+
+void LatencyMetrics::Reset()
+{
+	for (auto& histogram : m_phases)
+	{
+		histogram.Reset();
+	}
+}
+
+const wchar_t* LatencyMetrics::PhaseName(LatencyPhase phase)
+{
+	switch (phase)
+	{
+	case LatencyPhase::Queue: return L"queue";
+	case LatencyPhase::Serialize: return L"serialize";
+	case LatencyPhase::Write: return L"write";
+	case LatencyPhase::FirstByte: return L"firstByte";
+	case LatencyPhase::Body: return L"body";
+	case LatencyPhase::Parse: return L"parse";
+	default: return L"total";
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+namespace QED
+{
+	// Copy of a LatencyHistogram's counts; all values are in microseconds.
+	struct LatencySnapshot
+	{
+		LatencySnapshot();
+
+		unsigned long long count;
+		unsigned long long sum;
+		unsigned long long max;
+		std::vector<unsigned long long> buckets;
+
+		// p is a fraction, e.g. 0.99. Accurate to the width of a bucket, about 6% of the value.
+		double Percentile(double p) const;
+		double Mean() const;
+	};
+
+	// Log-linear histogram of durations that any number of threads record into without a lock.
+	// Each power of two is split into 16 buckets, from 1us up to about 12 days.
+	class LatencyHistogram
+	{
+	public:
+		LatencyHistogram();
+
+		void Record(std::chrono::microseconds elapsed);
+		// Counters are copied one by one while recording continues, so a snapshot taken under load
+		// may be off by the samples that land during the copy.
+		LatencySnapshot Snapshot() const;
+		void Reset();
+
+		static size_t BucketFor(unsigned long long micros);
+		// Midpoint of the values that fall in the bucket.
+		static unsigned long long BucketValue(size_t bucket);
+
+	private:
+		static const size_t SubBucketBits = 4;
+		static const size_t MaxExponent = 39;
+		static const size_t Buckets = ((MaxExponent - SubBucketBits + 1) << SubBucketBits) + (1 << SubBucketBits);
+
+		std::atomic<unsigned long long> m_buckets[Buckets];
+		std::atomic<unsigned long long> m_sum;
+		std::atomic<unsigned long long> m_max;
+
+		LatencyHistogram(const LatencyHistogram&);
+		LatencyHistogram& operator=(const LatencyHistogram&);
+	};
+
+	// Stages of a queue request, in the order they happen.
+	enum class LatencyPhase
+	{
+		// Waiting for a slot in the in-flight window.
+		Queue,
+		// Writing the JSON body, for sends that build one.
+		Serialize,
+		// From taking a slot until the body is uploaded. WinHTTP does not report connect and TLS
+		// separately, so a new connection's handshake is counted here.
+		Write,
+		// From the end of the upload until the response headers arrive.
+		FirstByte,
+		// From the response headers until the last byte of the body.
+		Body,
+		// JSON receives: parsing left over once the body has arrived; the rest overlaps Body.
+		Parse,
+		// From the call until its task completes, excluding Serialize.
+		Total
+	};
+
+	// One histogram per phase, e.g. for all sends of a queue.
+	class LatencyMetrics
+	{
+	public:
+		static const size_t PhaseCount = 7;
+
+		void Record(LatencyPhase phase, std::chrono::steady_clock::duration elapsed);
+		LatencySnapshot Snapshot(LatencyPhase phase) const;
+		void Reset();
+
+		static const wchar_t* PhaseName(LatencyPhase phase);
+
+	private:
+		LatencyHistogram m_phases[PhaseCount];
+	};
+}
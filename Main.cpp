@@ -1,12 +1,43 @@
+#include <cstdlib>
+#include <string>
+#include "MockBroker.h"
 #include "ServiceQueue.h"
 
 using namespace QED;
 
-void wmain()
+int wmain(int argc, wchar_t* argv[])
 {
+	// "local" runs the same calls against an in-process MockBroker instead of the live namespace.
+	bool local = argc > 1 && wstring(argv[1]) == L"local";
+	unique_ptr<MockBroker> broker;
+	if (local)
+	{
+		broker.reset(new MockBroker(web::uri(L"http://localhost:8765/")));
+		broker->Open();
+	}
+	wchar_t* key = nullptr;
+	size_t keyLength = 0;
+	_wdupenv_s(&key, &keyLength, L"SERVICEBUS_SAS_KEY");
 	ServiceQueue* queue = new ServiceQueue();
-	queue->SendJSON(L"https://solomonrain.servicebus.windows.net/solomonrainq/messages", L"SharedAccessSignature sr=https%3A%2F%2Fsolomonrain.servicebus.windows.net%2Fsolomonrainq%2Fmessages&sig=TVnT%2FQ17hPT340jIu61Yj28XqNNo8uoRrUgVtufUscA%3D&se=1413070578&skn=solomonrain");
-	queue->ReceiveJSON(L"https://solomonrain.servicebus.windows.net/solomonrainq/messages/head", L"SharedAccessSignature sr=https%3A%2F%2Fsolomonrain.servicebus.windows.net%2Fsolomonrainq%2Fmessages%2Fhead&sig=Rp0Oci7sYoEEfwlp4KQCHR%2B3PN%2BYe6oPx6lf8yc5whE%3D&se=1413070689&skn=solomonrain");
+	if (local)
+	{
+		queue->SendJSON(L"http://localhost:8765/solomonrainq/messages", L"");
+		queue->ReceiveJSON(L"http://localhost:8765/solomonrainq/messages/head?timeout=5", L"");
+	}
+	else if (key)
+	{
+		// Tokens are signed from the namespace key and refreshed in the background.
+		queue->SetTokenProvider(make_shared<SasTokenProvider>(L"solomonrain", key));
+		queue->SendJSON(L"https://solomonrain.servicebus.windows.net/solomonrainq/messages", L"");
+		queue->ReceiveJSON(L"https://solomonrain.servicebus.windows.net/solomonrainq/messages/head", L"");
+	}
+	else
+	{
+		queue->SendJSON(L"https://solomonrain.servicebus.windows.net/solomonrainq/messages", L"SharedAccessSignature sr=https%3A%2F%2Fsolomonrain.servicebus.windows.net%2Fsolomonrainq%2Fmessages&sig=TVnT%2FQ17hPT340jIu61Yj28XqNNo8uoRrUgVtufUscA%3D&se=1413070578&skn=solomonrain");
+		queue->ReceiveJSON(L"https://solomonrain.servicebus.windows.net/solomonrainq/messages/head", L"SharedAccessSignature sr=https%3A%2F%2Fsolomonrain.servicebus.windows.net%2Fsolomonrainq%2Fmessages%2Fhead&sig=Rp0Oci7sYoEEfwlp4KQCHR%2B3PN%2BYe6oPx6lf8yc5whE%3D&se=1413070689&skn=solomonrain");
+	}
+	free(key);
 	delete queue;
 	system("pause");
+	return 0;
 }
\ No newline at end of file
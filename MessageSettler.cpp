@@ -0,0 +1,186 @@
+#include "MessageSettler.h"
+
+using namespace ::pplx;
+using namespace web::http;
+using namespace QED;
+using namespace utility;
+using namespace std;
+
+SettleConflict::SettleConflict()
+	: runtime_error("a different settlement is already pending for this lock")
+{
+}
+
+MessageSettler::MessageSettler(Sender sender, TaskTimer& timer, size_t batchSize, chrono::milliseconds interval)
+	: m_sender(sender), m_timer(timer), m_batchSize(batchSize == 0 ? 1 : batchSize), m_interval(interval), m_flushing(false), m_armed(false)
+{
+}
+
+task<status_code> MessageSettler::Enqueue(SettleAction action, const string_t& lockLocation, const string_t& authcode)
+{
+	task_completion_event<status_code> settled;
+	bool flushNow = false;
+	bool arm = false;
+	{
+		lock_guard<mutex> guard(m_lock);
+		auto it = m_pending.find(lockLocation);
+		if (it == m_pending.end())
+		{
+			PendingSettle pending;
+			pending.action = action;
+			pending.authcode = authcode;
+			it = m_pending.insert(make_pair(lockLocation, pending)).first;
+		}
+		else if (it->second.action == SettleAction::RenewLock)
+		{
+			it->second.action = action;
+			it->second.authcode = authcode;
+		}
+		else if (action != SettleAction::RenewLock && action != it->second.action)
+		{
+			return task_from_exception<status_code>(SettleConflict());
+		}
+		it->second.waiters.push_back(settled);
+		if (!m_flushing)
+		{
+			if (m_pending.size() >= m_batchSize)
+			{
+				flushNow = m_flushing = true;
+			}
+			else if (!m_armed)
+			{
+				arm = m_armed = true;
+			}
+		}
+	}
+	if (flushNow)
+	{
+		StartFlush();
+	}
+	else if (arm)
+	{
+		Arm();
+	}
+	return create_task(settled);
+}
+
+task<void> MessageSettler::Flush()
+{
+	task_completion_event<void> flushed;
+	bool start = false;
+	{
+		lock_guard<mutex> guard(m_lock);
+		if (!m_flushing && m_pending.empty())
+		{
+			return task_from_result();
+		}
+		m_flushWaiters.push_back(flushed);
+		if (!m_flushing)
+		{
+			start = m_flushing = true;
+		}
+	}
+	if (start)
+	{
+		StartFlush();
+	}
+	return create_task(flushed);
+}
+
+size_t MessageSettler::Pending() const
+{
+	lock_guard<mutex> guard(m_lock);
+	return m_pending.size();
+}
+
+void MessageSettler::Arm()
+{
+	m_timer.After(m_interval).then([this]()
+	{
+		{
+			lock_guard<mutex> guard(m_lock);
+			m_armed = false;
+			if (m_flushing || m_pending.empty())
+			{
+				return;
+			}
+			m_flushing = true;
+		}
+		StartFlush();
+	});
+}
+
+void MessageSettler::StartFlush()
+{
+	Batch batch;
+	{
+		lock_guard<mutex> guard(m_lock);
+		batch.swap(m_pending);
+	}
+	vector<task<void>> sends;
+	for (auto& entry : batch)
+	{
+		auto waiters = entry.second.waiters;
+		sends.push_back(m_sender(entry.second.action, entry.first, entry.second.authcode).then([waiters](task<status_code> sent)
+		{
+			try
+			{
+				status_code status = sent.get();
+				for (auto& waiter : waiters)
+				{
+					waiter.set(status);
+				}
+			}
+			catch (...)
+			{
+				for (auto& waiter : waiters)
+				{
+					waiter.set_exception(current_exception());
+				}
+			}
+		}));
+	}
+	when_all(sends.begin(), sends.end()).then([this](task<void> done)
+	{
+		try
+		{
+			done.get();
+		}
+		catch (...)
+		{
+			// Each send's continuation has already failed its own waiters.
+		}
+		bool again = false;
+		bool arm = false;
+		vector<task_completion_event<void>> flushed;
+		{
+			lock_guard<mutex> guard(m_lock);
+			if (m_pending.size() >= m_batchSize || (!m_pending.empty() && !m_flushWaiters.empty()))
+			{
+				again = true;
+			}
+			else
+			{
+				m_flushing = false;
+				flushed.swap(m_flushWaiters);
+				if (!m_pending.empty() && !m_armed)
+				{
+					arm = m_armed = true;
+				}
+			}
+		}
+		if (again)
+		{
+			StartFlush();
+			return;
+		}
+		for (auto& waiter : flushed)
+		{
+			waiter.set();
+		}
+		if (arm)
+		{
+			Arm();
+		}
+	});
+}
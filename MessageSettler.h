@@ -0,0 +1,66 @@
+#pragma once
+#include <cpprest/http_msg.h>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include "TaskTimer.h"
+
+namespace QED
+{
+	enum class SettleAction
+	{
+		Complete,
+		Abandon,
+		RenewLock
+	};
+
+	class SettleConflict : public std::runtime_error
+	{
+	public:
+		SettleConflict();
+	};
+
+	// Collects settle calls for peek-locked messages and sends them together, either once
+	// batchSize locks are pending or after interval, with at most one flush outstanding.
+	// Requests for the same lock are coalesced: a pending Complete or Abandon absorbs any later
+	// RenewLock or repeat of itself, and a later Complete or Abandon replaces a pending RenewLock.
+	// Completing a lock with an Abandon pending, or the reverse, fails the later call with
+	// SettleConflict and leaves the pending one as it is.
+	class MessageSettler
+	{
+	public:
+		typedef std::function<pplx::task<web::http::status_code>(SettleAction, const utility::string_t&, const utility::string_t&)> Sender;
+
+		MessageSettler(Sender sender, TaskTimer& timer, size_t batchSize, std::chrono::milliseconds interval);
+
+		pplx::task<web::http::status_code> Enqueue(SettleAction action, const utility::string_t& lockLocation, const utility::string_t& authcode);
+		// Sends everything pending now and completes once no flush is outstanding.
+		pplx::task<void> Flush();
+		size_t Pending() const;
+
+	private:
+		struct PendingSettle
+		{
+			SettleAction action;
+			utility::string_t authcode;
+			std::vector<pplx::task_completion_event<web::http::status_code>> waiters;
+		};
+		typedef std::map<utility::string_t, PendingSettle> Batch;
+
+		void StartFlush();
+		void Arm();
+
+		Sender m_sender;
+		TaskTimer& m_timer;
+		size_t m_batchSize;
+		std::chrono::milliseconds m_interval;
+		Batch m_pending;
+		bool m_flushing;
+		bool m_armed;
+		std::vector<pplx::task_completion_event<void>> m_flushWaiters;
+		mutable std::mutex m_lock;
+	};
+}
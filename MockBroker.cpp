@@ -0,0 +1,387 @@
+#include <cpprest/json.h>
+#include <limits>
+#include <vector>
+#include "MockBroker.h"
+#include "Utf.h"
+
+using namespace ::pplx;
+using namespace web;
+using namespace web::http;
+using namespace web::http::experimental::listener;
+using namespace QED;
+using namespace utility;
+using namespace std;
+
+namespace
+{
+	// Long-poll timeouts are whole non-negative seconds; anything else is a malformed request.
+	bool ParseSeconds(const string_t& text, long long& seconds)
+	{
+		try
+		{
+			size_t used = 0;
+			seconds = stoll(text, &used);
+			return used == text.size() && seconds >= 0;
+		}
+		catch (const exception&)
+		{
+			return false;
+		}
+	}
+}
+
+MockBrokerConfig::MockBrokerConfig()
+	: latency(0), jitter(0), failureRate(0), failureStatus(status_codes::ServiceUnavailable), lockDuration(60)
+{
+}
+
+MockBroker::MockBroker(const uri& address, const MockBrokerConfig& config)
+	: m_address(address), m_config(config), m_listener(address), m_open(false), m_nextSequence(1), m_random(random_device()()),
+	m_delayed((numeric_limits<size_t>::max)())
+{
+	MockBrokerStats empty = {};
+	m_stats = empty;
+	m_listener.support([this](http_request request) { Handle(request); });
+}
+
+MockBroker::~MockBroker()
+{
+	Close();
+}
+
+void MockBroker::Open()
+{
+	m_closing = cancellation_token_source();
+	m_listener.open().wait();
+	lock_guard<mutex> guard(m_lock);
+	m_open = true;
+}
+
+void MockBroker::Close()
+{
+	{
+		lock_guard<mutex> guard(m_lock);
+		if (!m_open)
+		{
+			return;
+		}
+		m_open = false;
+	}
+	m_closing.cancel();
+	m_listener.close().wait();
+	m_delayed.WhenIdle().wait();
+	// Every request has been dispatched by now, and Receive parks no new waiters once closed.
+	vector<shared_ptr<Waiter>> waiters;
+	{
+		lock_guard<mutex> guard(m_lock);
+		for (auto& queue : m_queues)
+		{
+			for (auto& waiter : queue.second.waiters)
+			{
+				if (!waiter->answered)
+				{
+					waiter->answered = true;
+					waiters.push_back(waiter);
+				}
+			}
+			queue.second.waiters.clear();
+		}
+	}
+	for (auto& waiter : waiters)
+	{
+		waiter->request.reply(status_codes::NoContent);
+	}
+}
+
+const uri& MockBroker::Address() const
+{
+	return m_address;
+}
+
+size_t MockBroker::Depth(const string_t& queue) const
+{
+	lock_guard<mutex> guard(m_lock);
+	auto it = m_queues.find(queue);
+	return it == m_queues.end() ? 0 : it->second.messages.size();
+}
+
+MockBrokerStats MockBroker::Stats() const
+{
+	lock_guard<mutex> guard(m_lock);
+	return m_stats;
+}
+
+void MockBroker::Handle(http_request request)
+{
+	bool fail;
+	chrono::milliseconds delay = m_config.latency;
+	{
+		lock_guard<mutex> guard(m_lock);
+		fail = m_config.failureRate > 0 && uniform_real_distribution<double>(0, 1)(m_random) < m_config.failureRate;
+		if (m_config.jitter.count() > 0)
+		{
+			delay += chrono::milliseconds(uniform_int_distribution<long long>(0, m_config.jitter.count())(m_random));
+		}
+		if (fail)
+		{
+			++m_stats.failed;
+		}
+	}
+	m_delayed.Acquire();
+	m_timer.After(delay, m_closing.get_token()).then([this, request, fail](task<void> delayed)
+	{
+		try
+		{
+			delayed.get();
+			if (fail)
+			{
+				request.reply(m_config.failureStatus);
+			}
+			else
+			{
+				Dispatch(request);
+			}
+		}
+		catch (const task_canceled&)
+		{
+			request.reply(status_codes::ServiceUnavailable);
+		}
+		catch (const exception&)
+		{
+			// A path that does not decode; Release must still run or Close would wait forever.
+			request.reply(status_codes::BadRequest);
+		}
+		m_delayed.Release();
+	});
+}
+
+void MockBroker::Dispatch(http_request request)
+{
+	auto path = uri::split_path(uri::decode(request.relative_uri().path()));
+	if (path.size() < 2 || path[1] != L"messages")
+	{
+		request.reply(status_codes::NotFound);
+		return;
+	}
+	const string_t& queue = path[0];
+	if (path.size() == 2 && request.method() == methods::POST)
+	{
+		Enqueue(queue, request);
+	}
+	else if (path.size() == 3 && path[2] == L"head" && (request.method() == methods::POST || request.method() == methods::DEL))
+	{
+		Receive(queue, request, request.method() == methods::POST);
+	}
+	else if (path.size() == 4)
+	{
+		Settle(path[3], request);
+	}
+	else
+	{
+		request.reply(status_codes::MethodNotAllowed);
+	}
+}
+
+void MockBroker::Enqueue(const string_t& queue, http_request request)
+{
+	string_t contentType = request.headers().content_type();
+	request.extract_vector().then([this, queue, request, contentType](vector<unsigned char> body)
+	{
+		vector<Message> batch;
+		if (contentType.find(L"application/vnd.microsoft.servicebus.json") == 0)
+		{
+			json::value entries = json::value::parse(ToStringT(reinterpret_cast<const char*>(body.data()), body.size()));
+			for (size_t i = 0; i < entries.size(); ++i)
+			{
+				Message message;
+				message.body = ToUtf8(entries.at(i).at(L"Body").as_string());
+				batch.push_back(message);
+			}
+		}
+		else
+		{
+			Message message;
+			message.body.assign(body.begin(), body.end());
+			message.contentType = contentType;
+			batch.push_back(message);
+		}
+		vector<pair<http_request, http_response>> deliveries;
+		{
+			lock_guard<mutex> guard(m_lock);
+			Queue& target = m_queues[queue];
+			for (auto& message : batch)
+			{
+				message.sequenceNumber = m_nextSequence++;
+				message.deliveryCount = 0;
+				target.messages.push_back(message);
+				++m_stats.sent;
+			}
+			while (!target.messages.empty() && !target.waiters.empty())
+			{
+				auto waiter = target.waiters.front();
+				target.waiters.pop_front();
+				if (waiter->answered)
+				{
+					continue;
+				}
+				waiter->answered = true;
+				Message next = target.messages.front();
+				target.messages.pop_front();
+				deliveries.push_back(make_pair(waiter->request, Deliver(next, queue, waiter->peekLock)));
+			}
+		}
+		request.reply(status_codes::Created);
+		for (auto& delivery : deliveries)
+		{
+			delivery.first.reply(delivery.second);
+		}
+	}).then([request](task<void> enqueued)
+	{
+		try
+		{
+			enqueued.get();
+		}
+		catch (const exception&)
+		{
+			request.reply(status_codes::BadRequest);
+		}
+	});
+}
+
+void MockBroker::Receive(const string_t& queue, http_request request, bool peekLock)
+{
+	auto query = uri::split_query(request.relative_uri().query());
+	auto timeout = query.find(L"timeout");
+	long long seconds = 0;
+	if (timeout != query.end() && !ParseSeconds(timeout->second, seconds))
+	{
+		request.reply(status_codes::BadRequest);
+		return;
+	}
+	ExpireLocks();
+	shared_ptr<Waiter> waiter;
+	http_response response;
+	{
+		lock_guard<mutex> guard(m_lock);
+		Queue& source = m_queues[queue];
+		if (!source.messages.empty())
+		{
+			Message next = source.messages.front();
+			source.messages.pop_front();
+			response = Deliver(next, queue, peekLock);
+		}
+		else if (seconds > 0 && m_open)
+		{
+			waiter = make_shared<Waiter>();
+			waiter->request = request;
+			waiter->queue = queue;
+			waiter->peekLock = peekLock;
+			waiter->answered = false;
+			source.waiters.push_back(waiter);
+		}
+		else
+		{
+			response.set_status_code(status_codes::NoContent);
+		}
+	}
+	if (!waiter)
+	{
+		request.reply(response);
+		return;
+	}
+	m_timer.After(chrono::seconds(seconds)).then([this, waiter]()
+	{
+		{
+			lock_guard<mutex> guard(m_lock);
+			if (waiter->answered)
+			{
+				return;
+			}
+			waiter->answered = true;
+		}
+		waiter->request.reply(status_codes::NoContent);
+	});
+}
+
+http_response MockBroker::Deliver(Message message, const string_t& queue, bool peekLock)
+{
+	++m_stats.received;
+	++message.deliveryCount;
+	json::value properties;
+	properties[L"SequenceNumber"] = json::value::number(static_cast<double>(message.sequenceNumber));
+	properties[L"DeliveryCount"] = json::value::number(message.deliveryCount);
+	http_response response(peekLock ? status_codes::Created : status_codes::OK);
+	if (peekLock)
+	{
+		ostringstream_t token;
+		token << message.sequenceNumber << L"-" << m_random();
+		properties[L"LockToken"] = json::value::string(token.str());
+		uri_builder location(m_address);
+		location.append_path(queue).append_path(L"messages").append_path(conversions::print_string(message.sequenceNumber)).append_path(token.str());
+		response.headers().add(L"Location", location.to_string());
+		Lock lock;
+		lock.message = message;
+		lock.queue = queue;
+		lock.expires = chrono::steady_clock::now() + m_config.lockDuration;
+		m_locks[token.str()] = lock;
+	}
+	response.headers().add(L"BrokerProperties", properties.serialize());
+	response.set_body(vector<unsigned char>(message.body.begin(), message.body.end()));
+	if (!message.contentType.empty())
+	{
+		response.headers().set_content_type(message.contentType);
+	}
+	return response;
+}
+
+void MockBroker::Settle(const string_t& lockToken, http_request request)
+{
+	status_code status = status_codes::OK;
+	{
+		lock_guard<mutex> guard(m_lock);
+		auto lock = m_locks.find(lockToken);
+		if (lock == m_locks.end())
+		{
+			status = status_codes::NotFound;
+		}
+		else if (request.method() == methods::DEL)
+		{
+			m_locks.erase(lock);
+			++m_stats.completed;
+		}
+		else if (request.method() == methods::PUT)
+		{
+			m_queues[lock->second.queue].messages.push_front(lock->second.message);
+			m_locks.erase(lock);
+			++m_stats.abandoned;
+		}
+		else if (request.method() == methods::POST)
+		{
+			lock->second.expires = chrono::steady_clock::now() + m_config.lockDuration;
+			++m_stats.renewed;
+		}
+		else
+		{
+			status = status_codes::MethodNotAllowed;
+		}
+	}
+	request.reply(status);
+}
+
+void MockBroker::ExpireLocks()
+{
+	auto now = chrono::steady_clock::now();
+	lock_guard<mutex> guard(m_lock);
+	for (auto it = m_locks.begin(); it != m_locks.end();)
+	{
+		if (it->second.expires <= now)
+		{
+			m_queues[it->second.queue].messages.push_front(it->second.message);
+			it = m_locks.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <cpprest/http_listener.h>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include "InFlightWindow.h"
+#include "TaskTimer.h"
+
+namespace QED
+{
+	struct MockBrokerConfig
+	{
+		MockBrokerConfig();
+
+		// Every reply is delayed by latency plus a uniformly random share of jitter.
+		std::chrono::milliseconds latency;
+		std::chrono::milliseconds jitter;
+		// Fraction of requests, 0 to 1, answered with failureStatus instead of being served.
+		double failureRate;
+		web::http::status_code failureStatus;
+		// Peek-locked messages not settled within this long become visible again.
+		std::chrono::seconds lockDuration;
+	};
+
+	struct MockBrokerStats
+	{
+		unsigned long long sent;
+		unsigned long long received;
+		unsigned long long completed;
+		unsigned long long abandoned;
+		unsigned long long renewed;
+		unsigned long long failed;
+	};
+
+	// In-process stand-in for the Service Bus queue REST endpoints ServiceQueue talks to:
+	// POST {queue}/messages (single or batch), POST|DELETE {queue}/messages/head with the
+	// timeout long poll, and DELETE|PUT|POST on the lock URI returned in Location.
+	class MockBroker
+	{
+	public:
+		explicit MockBroker(const web::uri& address, const MockBrokerConfig& config = MockBrokerConfig());
+		~MockBroker();
+
+		void Open();
+		// Answers requests still waiting out the simulated latency with ServiceUnavailable and open
+		// long polls with NoContent before closing the listener.
+		void Close();
+		const web::uri& Address() const;
+		size_t Depth(const utility::string_t& queue) const;
+		MockBrokerStats Stats() const;
+
+	private:
+		struct Message
+		{
+			std::string body;
+			utility::string_t contentType;
+			long long sequenceNumber;
+			int deliveryCount;
+		};
+		struct Lock
+		{
+			Message message;
+			utility::string_t queue;
+			std::chrono::steady_clock::time_point expires;
+		};
+		struct Waiter
+		{
+			web::http::http_request request;
+			utility::string_t queue;
+			bool peekLock;
+			bool answered;
+		};
+		struct Queue
+		{
+			std::deque<Message> messages;
+			std::deque<std::shared_ptr<Waiter>> waiters;
+		};
+
+		void Handle(web::http::http_request request);
+		void Dispatch(web::http::http_request request);
+		void Enqueue(const utility::string_t& queue, web::http::http_request request);
+		void Receive(const utility::string_t& queue, web::http::http_request request, bool peekLock);
+		void Settle(const utility::string_t& lockToken, web::http::http_request request);
+		web::http::http_response Deliver(Message message, const utility::string_t& queue, bool peekLock);
+		void ExpireLocks();
+
+		web::uri m_address;
+		MockBrokerConfig m_config;
+		web::http::experimental::listener::http_listener m_listener;
+		bool m_open;
+		std::map<utility::string_t, Queue> m_queues;
+		std::map<utility::string_t, Lock> m_locks;
+		long long m_nextSequence;
+		MockBrokerStats m_stats;
+		std::mt19937 m_random;
+		mutable std::mutex m_lock;
+		TaskTimer m_timer;
+		pplx::cancellation_token_source m_closing;
+		// Requests inside the simulated latency, so Close can wait until each has been answered.
+		InFlightWindow m_delayed;
+	};
+}
@@ -0,0 +1,225 @@
+#include "QueueConsumer.h"
+
+using namespace ::pplx;
+using namespace web;
+using namespace QED;
+using namespace std;
+
+QueueConsumerConfig::QueueConsumerConfig()
+	: receivers(4), workers(thread::hardware_concurrency() == 0 ? 2 : thread::hardware_concurrency()), prefetch(64),
+	serverTimeout(30), mode(ReceiveMode::PeekLock), autoSettle(true)
+{
+}
+
+QueueConsumer::QueueConsumer(ServiceQueue& queue, const wstring& endpoint, const wstring& authcode, Handler handler, const QueueConsumerConfig& config)
+	: m_queue(queue),
+	m_endpoint(uri_builder(endpoint).append_query(L"timeout", config.serverTimeout.count()).to_string()),
+	m_authcode(authcode), m_handler(handler), m_config(config),
+	m_credits(config.prefetch < config.receivers ? config.receivers : config.prefetch),
+	m_running(false), m_handled(0), m_activeReceivers(0)
+{
+}
+
+QueueConsumer::~QueueConsumer()
+{
+	Stop();
+}
+
+void QueueConsumer::Start()
+{
+	if (m_running.exchange(true))
+	{
+		return;
+	}
+	m_receiversStopped = task_completion_event<void>();
+	m_stop = cancellation_token_source();
+	m_activeReceivers = m_config.receivers;
+	for (size_t i = 0; i < m_config.workers; ++i)
+	{
+		m_workers.push_back(thread([this]() { Work(); }));
+	}
+	for (size_t i = 0; i < m_config.receivers; ++i)
+	{
+		ReceiveNext();
+	}
+}
+
+void QueueConsumer::Stop()
+{
+	if (!m_running.exchange(false))
+	{
+		return;
+	}
+	m_stop.cancel();
+	m_ready.notify_all();
+	for (auto& worker : m_workers)
+	{
+		worker.join();
+	}
+	m_workers.clear();
+	// Returning the buffered credits first unblocks receivers waiting for room, which then see
+	// the consumer is stopping; polls already in flight may still land a message afterwards.
+	FlushBuffered();
+	create_task(m_receiversStopped).wait();
+	FlushBuffered();
+}
+
+size_t QueueConsumer::Buffered() const
+{
+	lock_guard<mutex> guard(m_lock);
+	return m_buffer.size();
+}
+
+unsigned long long QueueConsumer::Handled() const
+{
+	return m_handled;
+}
+
+void QueueConsumer::ReceiveNext()
+{
+	m_credits.Acquire().then([this]()
+	{
+		if (!m_running)
+		{
+			m_credits.Release();
+			ReceiverStopped();
+			return;
+		}
+		m_queue.ReceiveAsync(m_endpoint, m_authcode, m_config.mode, CallOptions(m_stop.get_token())).then([this](task<ReceivedMessage> received)
+		{
+			bool failed = false;
+			try
+			{
+				ReceivedMessage message = received.get();
+				if (message.HasMessage())
+				{
+					{
+						lock_guard<mutex> guard(m_lock);
+						m_buffer.push_back(move(message));
+					}
+					m_ready.notify_one();
+				}
+				else
+				{
+					m_credits.Release();
+				}
+			}
+			catch (const exception&)
+			{
+				m_credits.Release();
+				failed = true;
+			}
+			if (!m_running)
+			{
+				ReceiverStopped();
+			}
+			else if (failed)
+			{
+				m_timer.After(chrono::milliseconds(1000), m_stop.get_token()).then([this](task<void> waited)
+				{
+					try
+					{
+						waited.get();
+						ReceiveNext();
+					}
+					catch (const task_canceled&)
+					{
+						ReceiverStopped();
+					}
+				});
+			}
+			else
+			{
+				ReceiveNext();
+			}
+		});
+	});
+}
+
+void QueueConsumer::ReceiverStopped()
+{
+	bool last;
+	{
+		lock_guard<mutex> guard(m_lock);
+		last = --m_activeReceivers == 0;
+	}
+	if (last)
+	{
+		m_receiversStopped.set();
+	}
+}
+
+void QueueConsumer::Work()
+{
+	for (;;)
+	{
+		ReceivedMessage message;
+		{
+			unique_lock<mutex> guard(m_lock);
+			m_ready.wait(guard, [this]() { return !m_running || !m_buffer.empty(); });
+			// Peek-locked messages left behind are abandoned by Stop; received-and-deleted ones
+			// exist nowhere else, so they are handled before the worker exits.
+			if (m_buffer.empty() || (!m_running && m_config.mode == ReceiveMode::PeekLock))
+			{
+				return;
+			}
+			message = move(m_buffer.front());
+			m_buffer.pop_front();
+		}
+		Handle(message);
+		m_credits.Release();
+	}
+}
+
+void QueueConsumer::Handle(const ReceivedMessage& message)
+{
+	bool handled = true;
+	try
+	{
+		m_handler(message);
+	}
+	catch (...)
+	{
+		handled = false;
+	}
+	++m_handled;
+	Settle(message, handled);
+}
+
+void QueueConsumer::FlushBuffered()
+{
+	deque<ReceivedMessage> leftover;
+	{
+		lock_guard<mutex> guard(m_lock);
+		leftover.swap(m_buffer);
+	}
+	for (auto& message : leftover)
+	{
+		if (m_config.mode == ReceiveMode::ReceiveAndDelete)
+		{
+			// Already deleted by the broker, so the handler is its only chance.
+			Handle(message);
+		}
+		else if (!message.lockLocation.empty())
+		{
+			m_queue.Abandon(message, m_authcode);
+		}
+		m_credits.Release();
+	}
+}
+
+void QueueConsumer::Settle(const ReceivedMessage& message, bool handled)
+{
+	if (!m_config.autoSettle || m_config.mode != ReceiveMode::PeekLock || message.lockLocation.empty())
+	{
+		return;
+	}
+	if (handled)
+	{
+		m_queue.Complete(message, m_authcode);
+	}
+	else
+	{
+		m_queue.Abandon(message, m_authcode);
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ServiceQueue.h"
+
+namespace QED
+{
+	struct QueueConsumerConfig
+	{
+		QueueConsumerConfig();
+
+		// Long-poll receives kept outstanding against the broker.
+		size_t receivers;
+		// Threads draining the prefetch buffer into the handler.
+		size_t workers;
+		// Messages received or being received but not yet handled; receivers stall when it is full.
+		size_t prefetch;
+		// Passed as the server-side timeout query parameter, so an empty queue holds the poll open.
+		std::chrono::seconds serverTimeout;
+		ReceiveMode mode;
+		// Peek-lock only: complete messages the handler returns from, abandon those it throws on.
+		bool autoSettle;
+	};
+
+	class QueueConsumer
+	{
+	public:
+		typedef std::function<void(const ReceivedMessage&)> Handler;
+
+		QueueConsumer(ServiceQueue& queue, const wstring& endpoint, const wstring& authcode, Handler handler, const QueueConsumerConfig& config = QueueConsumerConfig());
+		~QueueConsumer();
+
+		void Start();
+		// Stops receiving, waits for the handler to finish the message it is on and abandons whatever
+		// is still buffered so the broker can redeliver it. In ReceiveAndDelete mode the broker holds
+		// no copy, so buffered messages are handled instead. Polls in flight are cancelled rather than
+		// waited out; one cancelled after the broker locked a message leaves it locked until expiry.
+		void Stop();
+		size_t Buffered() const;
+		unsigned long long Handled() const;
+
+	private:
+		void ReceiveNext();
+		void ReceiverStopped();
+		void Work();
+		void Handle(const ReceivedMessage&);
+		void FlushBuffered();
+		void Settle(const ReceivedMessage&, bool handled);
+
+		ServiceQueue& m_queue;
+		wstring m_endpoint;
+		wstring m_authcode;
+		Handler m_handler;
+		QueueConsumerConfig m_config;
+		InFlightWindow m_credits;
+		TaskTimer m_timer;
+		std::deque<ReceivedMessage> m_buffer;
+		std::vector<std::thread> m_workers;
+		std::atomic<bool> m_running;
+		std::atomic<unsigned long long> m_handled;
+		size_t m_activeReceivers;
+		pplx::task_completion_event<void> m_receiversStopped;
+		pplx::cancellation_token_source m_stop;
+		mutable std::mutex m_lock;
+		std::condition_variable m_ready;
+	};
+}
@@ -0,0 +1,51 @@
+#include "RequestPipeline.h"
+
+using namespace ::pplx;
+using namespace web::http;
+using namespace web::http::client;
+using namespace QED;
+using namespace std;
+
+PipelineNext::PipelineNext(const Stages* stages, size_t index, shared_ptr<http_client> client, cancellation_token token)
+	: m_stages(stages), m_index(index), m_client(client), m_token(token)
+{
+}
+
+task<http_response> PipelineNext::Send(http_request request) const
+{
+	if (m_index == m_stages->size())
+	{
+		return m_client->request(request, m_token);
+	}
+	return (*m_stages)[m_index]->Process(request, PipelineNext(m_stages, m_index + 1, m_client, m_token));
+}
+
+const cancellation_token& PipelineNext::Token() const
+{
+	return m_token;
+}
+
+RequestPipeline::RequestPipeline()
+{
+	m_snapshots.push_back(unique_ptr<const Stages>(new Stages()));
+	m_current.store(m_snapshots.back().get(), memory_order_release);
+}
+
+void RequestPipeline::Append(shared_ptr<PipelineStage> stage)
+{
+	lock_guard<mutex> guard(m_appendLock);
+	unique_ptr<Stages> next(new Stages(*m_snapshots.back()));
+	next->push_back(stage);
+	m_snapshots.push_back(std::move(next));
+	m_current.store(m_snapshots.back().get(), memory_order_release);
+}
+
+task<http_response> RequestPipeline::Send(shared_ptr<http_client> client, http_request request, cancellation_token token) const
+{
+	return PipelineNext(m_current.load(memory_order_acquire), 0, client, token).Send(request);
+}
+
+size_t RequestPipeline::Size() const
+{
+	return m_current.load(memory_order_acquire)->size();
+}
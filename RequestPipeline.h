@@ -0,0 +1,67 @@
+#pragma once
+#include <cpprest/http_client.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace QED
+{
+	class PipelineStage;
+
+	// The part of a pipeline after the current stage, ending at the client itself. Stages may keep
+	// it and send later, e.g. to retry, for as long as the pipeline exists.
+	class PipelineNext
+	{
+	public:
+		pplx::task<web::http::http_response> Send(web::http::http_request request) const;
+		// The token the request was sent with; cancelling it aborts the client call.
+		const pplx::cancellation_token& Token() const;
+
+	private:
+		friend class RequestPipeline;
+		typedef std::vector<std::shared_ptr<PipelineStage>> Stages;
+
+		PipelineNext(const Stages* stages, size_t index, std::shared_ptr<web::http::client::http_client> client, pplx::cancellation_token token);
+
+		const Stages* m_stages;
+		size_t m_index;
+		std::shared_ptr<web::http::client::http_client> m_client;
+		pplx::cancellation_token m_token;
+	};
+
+	class PipelineStage
+	{
+	public:
+		virtual ~PipelineStage() {}
+
+		// Hands the request on with next.Send, or answers it without going further.
+		virtual pplx::task<web::http::http_response> Process(web::http::http_request request, const PipelineNext& next) = 0;
+	};
+
+	// Request stages run in front of the client. The stage list is published as an immutable
+	// snapshot: Send reads it with a single atomic load and never locks, while Append copies the
+	// list, swaps the copy in and keeps the old one alive, since a request may still be walking
+	// it. Old snapshots are only freed with the pipeline, which must outlive its requests.
+	class RequestPipeline
+	{
+	public:
+		RequestPipeline();
+
+		void Append(std::shared_ptr<PipelineStage> stage);
+		pplx::task<web::http::http_response> Send(std::shared_ptr<web::http::client::http_client> client, web::http::http_request request,
+			pplx::cancellation_token token = pplx::cancellation_token::none()) const;
+		size_t Size() const;
+
+	private:
+		typedef PipelineNext::Stages Stages;
+
+		std::atomic<const Stages*> m_current;
+		// Every snapshot ever published, the current one last.
+		std::vector<std::unique_ptr<const Stages>> m_snapshots;
+		std::mutex m_appendLock;
+
+		RequestPipeline(const RequestPipeline&);
+		RequestPipeline& operator=(const RequestPipeline&);
+	};
+}
@@ -0,0 +1,224 @@
+#include "RetryStage.h"
+#include <memory>
+#include <vector>
+
+using namespace ::pplx;
+using namespace web;
+using namespace web::http;
+using namespace QED;
+using namespace utility;
+using namespace std;
+
+namespace
+{
+	const size64_t Unseekable = (numeric_limits<size64_t>::max)();
+
+	// A new request with the same method, URI, headers and handlers, reading the body again from
+	// position. Content-Length and Content-Type come across with the headers.
+	http_request Clone(const http_request& request, size64_t position)
+	{
+		http_request clone(request.method());
+		clone.set_request_uri(request.request_uri());
+		for (auto& header : request.headers())
+		{
+			clone.headers().add(header.first, header.second);
+		}
+		Concurrency::streams::istream body = request.body();
+		if (body.is_valid())
+		{
+			body.seek(position);
+			clone._get_impl()->set_instream(body);
+		}
+		auto impl = request._get_impl();
+		if (impl->_response_stream().is_valid())
+		{
+			clone.set_response_stream(impl->_response_stream());
+		}
+		if (impl->_progress_handler())
+		{
+			clone.set_progress_handler(*impl->_progress_handler());
+		}
+		return clone;
+	}
+
+	// Waits for the failed attempt's body and reads back whatever it wrote to the caller's stream.
+	task<void> DiscardBody(http_response response, Concurrency::streams::ostream stream)
+	{
+		return response.content_ready().then([stream](task<http_response> ready)
+		{
+			try
+			{
+				ready.wait();
+			}
+			catch (const http_exception&)
+			{
+			}
+			Concurrency::streams::streambuf<uint8_t> buffer = stream.streambuf();
+			size_t pending = buffer.in_avail();
+			if (pending == 0)
+			{
+				return task_from_result();
+			}
+			auto sink = make_shared<vector<uint8_t>>(pending);
+			return buffer.getn(sink->data(), pending).then([sink](size_t)
+			{
+			});
+		});
+	}
+
+	// Retry-After in delta-seconds; the HTTP-date form is left to the backoff.
+	bool ParseRetryAfter(const http_response& response, chrono::milliseconds& delay)
+	{
+		auto header = response.headers().find(L"Retry-After");
+		if (header == response.headers().end() || header->second.empty())
+		{
+			return false;
+		}
+		long long seconds = 0;
+		for (auto c : header->second)
+		{
+			if (c < '0' || c > '9' || seconds > 86400)
+			{
+				return false;
+			}
+			seconds = seconds * 10 + (c - '0');
+		}
+		delay = chrono::seconds(seconds);
+		return true;
+	}
+}
+
+RetryStageConfig::RetryStageConfig()
+	: maxRetries(3), baseDelay(100), maxDelay(5000), maxRetryAfter(30000), budgetRatio(0.1), budgetReserve(10), budgetMax(100)
+{
+}
+
+RetryBudget::RetryBudget(double ratio, size_t reserve, size_t limit)
+	: m_deposit(static_cast<long long>(ratio * Scale)), m_max(static_cast<long long>((max)(limit, reserve)) * Scale)
+{
+	m_tokens.store(static_cast<long long>(reserve) * Scale);
+}
+
+void RetryBudget::Deposit()
+{
+	long long tokens = m_tokens.load(memory_order_relaxed);
+	while (tokens < m_max && !m_tokens.compare_exchange_weak(tokens, (min)(tokens + m_deposit, m_max), memory_order_relaxed))
+	{
+	}
+}
+
+bool RetryBudget::Withdraw()
+{
+	long long tokens = m_tokens.load(memory_order_relaxed);
+	while (tokens >= Scale)
+	{
+		if (m_tokens.compare_exchange_weak(tokens, tokens - Scale, memory_order_relaxed))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+double RetryBudget::Available() const
+{
+	return static_cast<double>(m_tokens.load(memory_order_relaxed)) / Scale;
+}
+
+RetryStage::RetryStage(const RetryStageConfig& config, TaskTimer& timer)
+	: m_config(config), m_timer(timer), m_budget(config.budgetRatio, config.budgetReserve, config.budgetMax), m_random(random_device()())
+{
+	m_retries.store(0);
+	m_throttled.store(0);
+}
+
+task<http_response> RetryStage::Process(http_request request, const PipelineNext& next)
+{
+	if (m_config.maxRetries == 0 || request.request_uri().path().find(L"/messages") == string_t::npos)
+	{
+		return next.Send(request);
+	}
+	m_budget.Deposit();
+	Concurrency::streams::istream body = request.body();
+	size64_t position = 0;
+	if (body.is_valid())
+	{
+		position = body.can_seek() ? static_cast<size64_t>(body.tell()) : Unseekable;
+	}
+	return Attempt(request, next, 0, position);
+}
+
+size_t RetryStage::Retries() const
+{
+	return m_retries.load();
+}
+
+size_t RetryStage::Throttled() const
+{
+	return m_throttled.load();
+}
+
+task<http_response> RetryStage::Attempt(http_request request, PipelineNext next, size_t retries, size64_t position)
+{
+	return next.Send(request).then([this, request, next, retries, position](task<http_response> sent) -> task<http_response>
+	{
+		http_response response;
+		bool failed = false;
+		try
+		{
+			response = sent.get();
+		}
+		catch (const http_exception&)
+		{
+			failed = true;
+		}
+		if (!failed && !Retryable(response.status_code()))
+		{
+			return sent;
+		}
+		Concurrency::streams::ostream target = request._get_impl()->_response_stream();
+		// Give up without spending budget when the request cannot be replayed or was cancelled.
+		if (retries >= m_config.maxRetries || position == Unseekable || next.Token().is_canceled() || (!failed && target.is_valid() && !target.streambuf().can_read()))
+		{
+			return sent;
+		}
+		if (!m_budget.Withdraw())
+		{
+			++m_throttled;
+			return sent;
+		}
+		++m_retries;
+		chrono::milliseconds delay = Delay(retries, failed ? nullptr : &response);
+		task<void> drained = !failed && target.is_valid() ? DiscardBody(response, target) : task_from_result();
+		TaskTimer& timer = m_timer;
+		cancellation_token token = next.Token();
+		// Cancelling the request also cuts the backoff short.
+		return drained.then([&timer, delay, token]()
+		{
+			return timer.After(delay, token);
+		}).then([this, request, next, retries, position]()
+		{
+			return Attempt(Clone(request, position), next, retries + 1, position);
+		});
+	});
+}
+
+chrono::milliseconds RetryStage::Delay(size_t retries, const http_response* response)
+{
+	chrono::milliseconds retryAfter;
+	if (response != nullptr && ParseRetryAfter(*response, retryAfter))
+	{
+		return (min)(retryAfter, m_config.maxRetryAfter);
+	}
+	// Full jitter: spreading retries over the whole window keeps clients that failed together
+	// from coming back together.
+	long long ceiling = m_config.baseDelay.count() << (min)(retries, static_cast<size_t>(20));
+	ceiling = (min)(ceiling, static_cast<long long>(m_config.maxDelay.count()));
+	lock_guard<mutex> guard(m_randomLock);
+	return chrono::milliseconds(uniform_int_distribution<long long>(0, ceiling)(m_random));
+}
+
+bool RetryStage::Retryable(status_code status)
+{
+	return status == 429 || status == status_codes::InternalError || status == status_codes::ServiceUnavailable;
+}
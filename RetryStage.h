@@ -0,0 +1,79 @@
+#pragma once
+#include <cpprest/http_client.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include "RequestPipeline.h"
+#include "TaskTimer.h"
+
+namespace QED
+{
+	struct RetryStageConfig
+	{
+		RetryStageConfig();
+
+		// Retries after the first attempt; 0 turns the stage off.
+		size_t maxRetries;
+		// The nth retry waits a uniformly random time up to baseDelay * 2^n, capped at maxDelay.
+		std::chrono::milliseconds baseDelay;
+		std::chrono::milliseconds maxDelay;
+		// A Retry-After from the broker replaces the backoff, up to this long.
+		std::chrono::milliseconds maxRetryAfter;
+		// Each first attempt earns this fraction of a retry, so retries stay a bounded share of
+		// live traffic however many requests fail.
+		double budgetRatio;
+		// Retries available before any traffic has earned them, and the most that can be banked.
+		size_t budgetReserve;
+		size_t budgetMax;
+	};
+
+	// Token bucket shared by every request through a stage: deposits come from first attempts and
+	// each retry withdraws one token. Tokens are kept in thousandths so both sides are a CAS.
+	class RetryBudget
+	{
+	public:
+		RetryBudget(double ratio, size_t reserve, size_t limit);
+
+		void Deposit();
+		bool Withdraw();
+		double Available() const;
+
+	private:
+		static const long long Scale = 1000;
+
+		std::atomic<long long> m_tokens;
+		long long m_deposit;
+		long long m_max;
+	};
+
+	// Retries requests to /messages endpoints that fail with 429, 500 or 503 or with a transport
+	// error, waiting a jittered exponential backoff or the broker's Retry-After between attempts.
+	// The request is rebuilt for each attempt with its body stream rewound, so bodies that cannot
+	// seek are sent once. A failed attempt's body is drained from a caller-supplied response
+	// stream before the next attempt writes to it.
+	class RetryStage : public PipelineStage
+	{
+	public:
+		RetryStage(const RetryStageConfig& config, TaskTimer& timer);
+
+		pplx::task<web::http::http_response> Process(web::http::http_request request, const PipelineNext& next);
+
+		size_t Retries() const;
+		// Retries skipped because the budget was empty.
+		size_t Throttled() const;
+
+	private:
+		pplx::task<web::http::http_response> Attempt(web::http::http_request request, PipelineNext next, size_t retries, utility::size64_t position);
+		std::chrono::milliseconds Delay(size_t retries, const web::http::http_response* response);
+		static bool Retryable(web::http::status_code status);
+
+		RetryStageConfig m_config;
+		TaskTimer& m_timer;
+		RetryBudget m_budget;
+		std::mt19937 m_random;
+		std::mutex m_randomLock;
+		std::atomic<size_t> m_retries;
+		std::atomic<size_t> m_throttled;
+	};
+}
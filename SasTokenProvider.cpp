@@ -0,0 +1,160 @@
+#include <windows.h>
+#include <bcrypt.h>
+#include <cpprest/asyncrt_utils.h>
+#include <ctime>
+#include <limits>
+#include <stdexcept>
+#include "Base64.h"
+#include "SasTokenProvider.h"
+#include "Utf.h"
+
+#pragma comment(lib, "bcrypt.lib")
+
+using namespace ::pplx;
+using namespace web;
+using namespace QED;
+using namespace utility;
+using namespace std;
+
+SasTokenProvider::SasTokenProvider(const string_t& keyName, const string_t& key, chrono::seconds lifetime, chrono::seconds refreshMargin)
+	: m_keyName(keyName), m_key(ToUtf8(key)), m_lifetime(lifetime),
+	m_refreshMargin(refreshMargin < lifetime ? refreshMargin : lifetime / 2), m_algorithm(nullptr),
+	m_refreshes((numeric_limits<size_t>::max)())
+{
+	BCRYPT_ALG_HANDLE algorithm = nullptr;
+	if (!BCRYPT_SUCCESS(BCryptOpenAlgorithmProvider(&algorithm, BCRYPT_SHA256_ALGORITHM, nullptr, BCRYPT_ALG_HANDLE_HMAC_FLAG)))
+	{
+		throw runtime_error("unable to open the HMAC-SHA256 provider");
+	}
+	m_algorithm = algorithm;
+}
+
+SasTokenProvider::~SasTokenProvider()
+{
+	m_stop.cancel();
+	m_refreshes.WhenIdle().wait();
+	BCryptCloseAlgorithmProvider(static_cast<BCRYPT_ALG_HANDLE>(m_algorithm), 0);
+}
+
+string_t SasTokenProvider::GetToken(const string_t& resource)
+{
+	{
+		lock_guard<mutex> guard(m_lock);
+		auto cached = m_tokens.find(resource);
+		if (cached != m_tokens.end() && cached->second.expiry - m_refreshMargin.count() / 2 > Now())
+		{
+			cached->second.used = true;
+			return cached->second.value;
+		}
+	}
+	// First use, or the background refresh fell behind: sign inline rather than hand out a stale token.
+	Token token = Sign(resource);
+	token.used = true;
+	bool schedule;
+	{
+		lock_guard<mutex> guard(m_lock);
+		schedule = m_tokens.find(resource) == m_tokens.end();
+		m_tokens[resource] = token;
+	}
+	if (schedule)
+	{
+		ScheduleRefresh(resource, token.expiry);
+	}
+	return token.value;
+}
+
+string_t SasTokenProvider::ResourceFor(const uri& target)
+{
+	string_t path = target.path();
+	size_t messages = path.find(L"/messages");
+	if (messages != string_t::npos)
+	{
+		path.erase(messages);
+	}
+	return uri_builder(target.authority()).set_path(path).to_string();
+}
+
+SasTokenProvider::Token SasTokenProvider::Sign(const string_t& resource) const
+{
+	Token token;
+	token.expiry = Now() + m_lifetime.count();
+	token.used = false;
+	string_t encoded = uri::encode_data_string(resource);
+	string_t expiry = conversions::print_string(token.expiry);
+	vector<unsigned char> digest = Hmac(ToUtf8(encoded + L"\n" + expiry));
+	string_t signature = ToBase64(digest.data(), digest.size());
+	token.value = L"SharedAccessSignature sr=" + encoded + L"&sig=" + uri::encode_data_string(signature) + L"&se=" + expiry + L"&skn=" + m_keyName;
+	return token;
+}
+
+vector<unsigned char> SasTokenProvider::Hmac(const string& data) const
+{
+	vector<unsigned char> digest(32);
+	BCRYPT_HASH_HANDLE hash = nullptr;
+	bool signedOk = BCRYPT_SUCCESS(BCryptCreateHash(static_cast<BCRYPT_ALG_HANDLE>(m_algorithm), &hash, nullptr, 0,
+			reinterpret_cast<PUCHAR>(const_cast<char*>(m_key.data())), static_cast<ULONG>(m_key.size()), 0))
+		&& BCRYPT_SUCCESS(BCryptHashData(hash, reinterpret_cast<PUCHAR>(const_cast<char*>(data.data())), static_cast<ULONG>(data.size()), 0))
+		&& BCRYPT_SUCCESS(BCryptFinishHash(hash, digest.data(), static_cast<ULONG>(digest.size()), 0));
+	if (hash != nullptr)
+	{
+		BCryptDestroyHash(hash);
+	}
+	if (!signedOk)
+	{
+		throw runtime_error("unable to compute the SAS signature");
+	}
+	return digest;
+}
+
+void SasTokenProvider::ScheduleRefresh(const string_t& resource, long long expiry)
+{
+	long long delay = expiry - m_refreshMargin.count() - Now();
+	m_refreshes.Acquire();
+	m_timer.After(chrono::seconds(delay > 0 ? delay : 0), m_stop.get_token()).then([this, resource](task<void> due)
+	{
+		try
+		{
+			due.get();
+			Refresh(resource);
+		}
+		catch (const task_canceled&)
+		{
+		}
+		catch (const exception&)
+		{
+			// Signing failed; drop the token so the next GetToken signs inline and reports the error.
+			lock_guard<mutex> guard(m_lock);
+			m_tokens.erase(resource);
+		}
+		m_refreshes.Release();
+	});
+}
+
+void SasTokenProvider::Refresh(const string_t& resource)
+{
+	{
+		lock_guard<mutex> guard(m_lock);
+		auto cached = m_tokens.find(resource);
+		if (cached == m_tokens.end())
+		{
+			return;
+		}
+		if (!cached->second.used)
+		{
+			// Idle since the last refresh; GetToken signs and reschedules if it is asked for again.
+			m_tokens.erase(cached);
+			return;
+		}
+	}
+	Token token = Sign(resource);
+	{
+		lock_guard<mutex> guard(m_lock);
+		m_tokens[resource] = token;
+	}
+	ScheduleRefresh(resource, token.expiry);
+}
+
+long long SasTokenProvider::Now()
+{
+	return static_cast<long long>(time(nullptr));
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cpprest/uri.h>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "InFlightWindow.h"
+#include "TaskTimer.h"
+
+namespace QED
+{
+	// Issues SharedAccessSignature tokens signed with HMAC-SHA256 over the URL-encoded resource
+	// URI and expiry. Tokens are cached per resource and re-signed on a background timer
+	// refreshMargin before they expire, so GetToken only signs the first time a resource is seen.
+	// A resource nobody asked for since its last refresh is dropped instead of re-signed.
+	class SasTokenProvider
+	{
+	public:
+		SasTokenProvider(const utility::string_t& keyName, const utility::string_t& key,
+			std::chrono::seconds lifetime = std::chrono::seconds(3600), std::chrono::seconds refreshMargin = std::chrono::seconds(300));
+		~SasTokenProvider();
+
+		utility::string_t GetToken(const utility::string_t& resource);
+		// The entity a request URI belongs to: everything before the /messages segment.
+		static utility::string_t ResourceFor(const web::uri& target);
+
+	private:
+		struct Token
+		{
+			utility::string_t value;
+			long long expiry;
+			bool used;
+		};
+
+		Token Sign(const utility::string_t& resource) const;
+		std::vector<unsigned char> Hmac(const std::string& data) const;
+		void ScheduleRefresh(const utility::string_t& resource, long long expiry);
+		void Refresh(const utility::string_t& resource);
+		static long long Now();
+
+		utility::string_t m_keyName;
+		std::string m_key;
+		std::chrono::seconds m_lifetime;
+		std::chrono::seconds m_refreshMargin;
+		void* m_algorithm;
+		std::map<utility::string_t, Token> m_tokens;
+		mutable std::mutex m_lock;
+		TaskTimer m_timer;
+		pplx::cancellation_token_source m_stop;
+		// Tracks scheduled refreshes so the destructor can wait them out before closing m_algorithm.
+		InFlightWindow m_refreshes;
+
+		SasTokenProvider(const SasTokenProvider&);
+		SasTokenProvider& operator=(const SasTokenProvider&);
+	};
+}
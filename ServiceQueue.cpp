@@ -1,7 +1,20 @@
 #pragma once
 #include <cpprest/http_client.h>
 #include <cpprest/json.h>
+#include <cpprest/producerconsumerstream.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <random>
+#include "JsonObject.h"
+#include "JsonReader.h"
+#include "JsonStreamParser.h"
+#include "JsonWriter.h"
 #include "ServiceQueue.h"
+#include "Utf.h"
 
 using namespace ::pplx;
 using namespace web;
@@ -12,52 +25,746 @@ using namespace utility;
 using namespace std;
 using namespace Concurrency::streams;
 
+ServiceQueueConfig::ServiceQueueConfig()
+	: maxInFlight(1024), settleBatchSize(64), settleInterval(50)
+{
+}
+
+CallOptions::CallOptions()
+	: token(cancellation_token::none()), timeout(0)
+{
+}
+
+CallOptions::CallOptions(cancellation_token callToken)
+	: token(callToken), timeout(0)
+{
+}
+
+CallOptions::CallOptions(chrono::milliseconds callTimeout)
+	: token(cancellation_token::none()), timeout(callTimeout)
+{
+}
+
+CallOptions::CallOptions(cancellation_token callToken, chrono::milliseconds callTimeout)
+	: token(callToken), timeout(callTimeout)
+{
+}
+
+bool SendResult::Succeeded() const
+{
+	return status == status_codes::Created || status == status_codes::OK;
+}
+
+bool ReceivedMessage::HasMessage() const
+{
+	return status == status_codes::Created || status == status_codes::OK;
+}
+
+const char* ReceivedMessage::Data() const
+{
+	return body ? reinterpret_cast<const char*>(body->Data()) : "";
+}
+
+size_t ReceivedMessage::Size() const
+{
+	return body ? body->Size() : 0;
+}
+
+namespace
+{
+	// Receive bodies are buffered in blocks of this size, drawn from the producer/consumer block pool.
+	const size_t InboundBlockBytes = 16 * 1024;
+	const wchar_t* const SendContentType = L"application/atom+xml;type=entry;charset=utf-8";
+
+	// Seeded once at load; message ids only need to be unique, not unpredictable.
+	mutex MessageIdLock;
+	mt19937_64 MessageIdRandom((random_device()()));
+
+	wstring NewMessageId()
+	{
+		unsigned long long high, low;
+		{
+			lock_guard<mutex> guard(MessageIdLock);
+			high = MessageIdRandom();
+			low = MessageIdRandom();
+		}
+		wchar_t text[33];
+		swprintf_s(text, _countof(text), L"%016llx%016llx", high, low);
+		return text;
+	}
+
+	typedef chrono::steady_clock Clock;
+
+	// Phase boundaries of one request, stamped as it moves along and recorded when it ends. Unset
+	// points are left at the epoch and their phases skipped.
+	struct RequestTimeline
+	{
+		RequestTimeline() : queued(Clock::now()), written(0) {}
+
+		void Record(LatencyMetrics& metrics) const
+		{
+			const Clock::time_point unset;
+			Clock::time_point uploaded = Clock::time_point(Clock::duration(written.load()));
+			if (started != unset)
+			{
+				metrics.Record(LatencyPhase::Queue, started - queued);
+			}
+			if (started != unset && uploaded != unset)
+			{
+				metrics.Record(LatencyPhase::Write, uploaded - started);
+			}
+			if (uploaded != unset && headers != unset)
+			{
+				metrics.Record(LatencyPhase::FirstByte, headers - uploaded);
+			}
+			if (headers != unset && ended != unset)
+			{
+				metrics.Record(LatencyPhase::Body, ended - headers);
+			}
+			if (ended != unset && parsed != unset)
+			{
+				metrics.Record(LatencyPhase::Parse, parsed - ended);
+			}
+			metrics.Record(LatencyPhase::Total, Clock::now() - queued);
+		}
+
+		Clock::time_point queued;
+		Clock::time_point started;
+		atomic<Clock::rep> written;
+		Clock::time_point headers;
+		Clock::time_point ended;
+		Clock::time_point parsed;
+	};
+
+	// The end of the upload is only visible to the client's progress callback, which runs on its
+	// I/O thread, hence the atomic stamp.
+	void WatchUpload(http_request& request, shared_ptr<RequestTimeline> timeline, size_t length)
+	{
+		request.set_progress_handler([timeline, length](message_direction::direction direction, utility::size64_t bytes)
+		{
+			if (direction == message_direction::upload && bytes >= length)
+			{
+				Clock::rep unset = 0;
+				timeline->written.compare_exchange_strong(unset, Clock::now().time_since_epoch().count());
+			}
+		});
+	}
+
+	// Reads until expected bytes have arrived or the stream ends, moving to a larger pooled
+	// buffer only when a body without Content-Length outgrows the current one.
+	task<shared_ptr<PooledBuffer>> ReadBody(Concurrency::streams::streambuf<uint8_t> source, BufferPool& pool, shared_ptr<PooledBuffer> target, size_t expected)
+	{
+		if (target->Size() >= expected)
+		{
+			return task_from_result(target);
+		}
+		if (target->Size() == target->Capacity())
+		{
+			auto larger = pool.Acquire(target->Capacity() * 2);
+			memcpy(larger->Data(), target->Data(), target->Size());
+			larger->SetSize(target->Size());
+			target = larger;
+		}
+		size_t offset = target->Size();
+		return source.getn(target->Data() + offset, target->Capacity() - offset).then([source, &pool, target, offset, expected](size_t read) -> task<shared_ptr<PooledBuffer>>
+		{
+			if (read == 0)
+			{
+				return task_from_result(target);
+			}
+			target->SetSize(offset + read);
+			return ReadBody(source, pool, target, expected);
+		});
+	}
+
+	// Status and broker headers of a receive response; the body is filled in separately.
+	ReceivedMessage ReadEnvelope(const http_response& response)
+	{
+		ReceivedMessage message;
+		message.status = response.status_code();
+		message.sequenceNumber = 0;
+		message.deliveryCount = 0;
+		auto& headers = response.headers();
+		auto location = headers.find(L"Location");
+		if (location != headers.end())
+		{
+			message.lockLocation = location->second;
+		}
+		auto properties = headers.find(L"BrokerProperties");
+		if (properties != headers.end())
+		{
+			// Pull the three fields we use straight out of the text instead of building a DOM for it.
+			string text = ToUtf8(properties->second);
+			JsonFields broker({ "LockToken", "SequenceNumber", "DeliveryCount" });
+			JsonReader reader(broker);
+			reader.Feed(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+			reader.Finish();
+			if (broker.Has("LockToken"))
+			{
+				message.lockToken = ToStringT(broker.Get("LockToken"));
+			}
+			if (broker.Has("SequenceNumber"))
+			{
+				message.sequenceNumber = strtoll(broker.Get("SequenceNumber").c_str(), nullptr, 10);
+			}
+			if (broker.Has("DeliveryCount"))
+			{
+				message.deliveryCount = atoi(broker.Get("DeliveryCount").c_str());
+			}
+		}
+		return message;
+	}
+}
+
+ServiceQueue::ServiceQueue()
+	: m_window(ServiceQueueConfig().maxInFlight), m_callbacks((numeric_limits<size_t>::max)()),
+	m_settler([this](SettleAction action, const wstring& location, const wstring& authcode) { return Settle(action, location, authcode); },
+		m_timer, ServiceQueueConfig().settleBatchSize, ServiceQueueConfig().settleInterval),
+	m_sendLimiter(ServiceQueueConfig().sendLimit), m_retry(make_shared<RetryStage>(ServiceQueueConfig().retry, m_timer)),
+	m_hedge(ServiceQueueConfig().hedge), m_hedgeBudget(m_hedge.budgetRatio, m_hedge.budgetReserve, m_hedge.budgetMax)
+{
+	m_hedged.store(0);
+	m_pipeline.Append(m_retry);
+}
+
+ServiceQueue::ServiceQueue(const ServiceQueueConfig& config)
+	: m_pool(config.pool), m_window(config.maxInFlight), m_callbacks((numeric_limits<size_t>::max)()),
+	m_settler([this](SettleAction action, const wstring& location, const wstring& authcode) { return Settle(action, location, authcode); },
+		m_timer, config.settleBatchSize, config.settleInterval),
+	m_sendLimiter(config.sendLimit), m_retry(make_shared<RetryStage>(config.retry, m_timer)),
+	m_hedge(config.hedge), m_hedgeBudget(m_hedge.budgetRatio, m_hedge.budgetReserve, m_hedge.budgetMax)
+{
+	m_hedged.store(0);
+	m_pipeline.Append(m_retry);
+}
+
+ServiceQueue::~ServiceQueue()
+{
+	Drain().wait();
+}
+
+ClientPool& ServiceQueue::Pool()
+{
+	return m_pool;
+}
+
+InFlightWindow& ServiceQueue::Window()
+{
+	return m_window;
+}
+
+RequestPipeline& ServiceQueue::Pipeline()
+{
+	return m_pipeline;
+}
+
+AdaptiveLimiter& ServiceQueue::SendLimiter()
+{
+	return m_sendLimiter;
+}
+
+RetryStage& ServiceQueue::Retry()
+{
+	return *m_retry;
+}
+
+size_t ServiceQueue::Hedged() const
+{
+	return m_hedged.load();
+}
+
+LatencyMetrics& ServiceQueue::SendLatency()
+{
+	return m_sendLatency;
+}
+
+LatencyMetrics& ServiceQueue::ReceiveLatency()
+{
+	return m_receiveLatency;
+}
+
+void ServiceQueue::SetTokenProvider(shared_ptr<SasTokenProvider> provider)
+{
+	lock_guard<mutex> guard(m_providerLock);
+	m_tokenProvider = provider;
+}
+
+task<void> ServiceQueue::Drain()
+{
+	InFlightWindow& window = m_window;
+	MessageSettler& settler = m_settler;
+	AdaptiveLimiter& limiter = m_sendLimiter;
+	BufferPool& buffers = m_buffers;
+	return m_callbacks.WhenIdle().then([&settler]()
+	{
+		return settler.Flush();
+	}).then([&limiter]()
+	{
+		// Sends hold a limiter slot from before they take a window slot until after they release it.
+		return limiter.WhenIdle();
+	}).then([&window]()
+	{
+		return window.WhenIdle();
+	}).then([&buffers]()
+	{
+		// Hand the response blocks and bodies cached during a burst back to the heap once it is over.
+		Concurrency::streams::details::_block_pool::trim();
+		buffers.Trim();
+	});
+}
+
+task<void> ServiceQueue::Shutdown()
+{
+	m_shutdown.cancel();
+	return Drain();
+}
+
 void ServiceQueue::SendJSON(const wstring& endpoint, const wstring& authcode)
 {
-	json::value obj;
+	JsonObject obj;
 	obj[L"key1"] = json::value::boolean(false);
 	obj[L"key2"] = json::value::number(44);
 	obj[L"key3"] = json::value::number(43.6);
 	obj[L"key4"] = json::value::string(U("str"));
-	http_client client(endpoint);
-	http_request request(methods::POST);
-	request.headers().add(L"Authorization", authcode);
-	request.headers().add(L"Content-Type", L"application/atom+xml;type=entry;charset=utf-8");
-	request.set_body(obj);
-	client.request(request).then([](http_response response)
+	SendAsync(endpoint, authcode, obj.ToValue()).then([](task<SendResult> result)
 	{
-		wcout << response.status_code() << "\n" << endl;
+		try
+		{
+			wcout << result.get().status << "\n" << endl;
+		}
+		catch (const exception& e)
+		{
+			wostringstream ss;
+			ss << e.what() << endl;
+			wcout << ss.str();
+		}
 	});
 }
 
 void ServiceQueue::ReceiveJSON(const wstring& endpoint, const wstring& authcode)
 {
-	http_client client(endpoint);
-	http_request request(methods::POST);
-	request.headers().add(L"Authorization", authcode);
-	client.request(request)
-		.then([](http_response response)-> Concurrency::streams::istream
-	{
-		return response.body();
-	})
-		.then([](Concurrency::streams::istream result)
+	m_callbacks.Acquire();
+	ReceiveJsonAsync(endpoint, authcode).then([this, authcode](task<ReceivedMessage> result)
 	{
 		try
 		{
-			container_buffer<string> inBuffer;
-			return result.read_to_end(inBuffer)
-				.then([inBuffer](size_t byteRead)
+			ReceivedMessage message = result.get();
+			wcout << message.document.serialize() << "\n" << endl;
+			if (message.HasMessage() && !message.lockLocation.empty())
 			{
-				const string& text = inBuffer.collection();
-				cout << text << "\n" << endl;
-			});
+				Complete(message, authcode);
+			}
 		}
-		catch (const http_exception& e)
+		catch (const exception& e)
 		{
 			wostringstream ss;
 			ss << e.what() << endl;
 			wcout << ss.str();
 		}
+		m_callbacks.Release();
 	});
 }
-	
+
+task<SendResult> ServiceQueue::SendAsync(const wstring& endpoint, const wstring& authcode, const json::value& message, const CallOptions& options)
+{
+	auto started = Clock::now();
+	auto body = make_shared<string>();
+	JsonWriter::Write(message, *body);
+	m_sendLatency.Record(LatencyPhase::Serialize, Clock::now() - started);
+	if (!m_hedge.sends || body->size() > m_hedge.maxSendBytes)
+	{
+		return Call<SendResult>(options, [this, endpoint, authcode, body](cancellation_token token)
+		{
+			return Post(endpoint, authcode, move(*body), SendContentType, 1, token);
+		});
+	}
+	wstring messageId = NewMessageId();
+	return Call<SendResult>(options, [this, endpoint, authcode, body, messageId](cancellation_token token)
+	{
+		return Hedged<SendResult>(m_sendLatency, token, [this, endpoint, authcode, body, messageId](cancellation_token attempt)
+		{
+			return Post(endpoint, authcode, *body, SendContentType, 1, attempt, messageId);
+		}, [](const SendResult&) {});
+	});
+}
+
+task<SendResult> ServiceQueue::SendAsync(const wstring& endpoint, const wstring& authcode, const uint8_t* data, size_t length, const wstring& contentType,
+	const CallOptions& options)
+{
+	if (!m_hedge.sends || length > m_hedge.maxSendBytes)
+	{
+		return SendAsync(endpoint, authcode, rawptr_buffer<uint8_t>(data, length), length, contentType, options);
+	}
+	// The task completes with the winning attempt while the loser may still be uploading, so a
+	// hedged send copies the bytes rather than borrowing them past the caller's wait.
+	auto body = make_shared<string>(reinterpret_cast<const char*>(data), length);
+	wstring messageId = NewMessageId();
+	return Call<SendResult>(options, [this, endpoint, authcode, body, contentType, messageId](cancellation_token token)
+	{
+		return Hedged<SendResult>(m_sendLatency, token, [this, endpoint, authcode, body, contentType, messageId](cancellation_token attempt)
+		{
+			return Post(endpoint, authcode, *body, contentType, 1, attempt, messageId);
+		}, [](const SendResult&) {});
+	});
+}
+
+task<SendResult> ServiceQueue::SendAsync(const wstring& endpoint, const wstring& authcode, rawptr_buffer<uint8_t> buffer, size_t length, const wstring& contentType,
+	const CallOptions& options)
+{
+	return Call<SendResult>(options, [this, endpoint, authcode, buffer, length, contentType](cancellation_token token)
+	{
+		return Post(endpoint, authcode, buffer.create_istream(), length, contentType, 1, token);
+	});
+}
+
+task<ReceivedMessage> ServiceQueue::ReceiveAsync(const wstring& endpoint, const wstring& authcode, ReceiveMode mode, const CallOptions& options)
+{
+	bool hedge = m_hedge.receives && mode == ReceiveMode::PeekLock;
+	return Call<ReceivedMessage>(options, [this, endpoint, authcode, mode, hedge](cancellation_token token)
+	{
+		return hedge ? HedgeReceive(endpoint, authcode, false, token) : Receive(endpoint, authcode, mode, false, token);
+	});
+}
+
+task<ReceivedMessage> ServiceQueue::ReceiveJsonAsync(const wstring& endpoint, const wstring& authcode, ReceiveMode mode, const CallOptions& options)
+{
+	bool hedge = m_hedge.receives && mode == ReceiveMode::PeekLock;
+	return Call<ReceivedMessage>(options, [this, endpoint, authcode, mode, hedge](cancellation_token token)
+	{
+		return hedge ? HedgeReceive(endpoint, authcode, true, token) : Receive(endpoint, authcode, mode, true, token);
+	});
+}
+
+// Only peek-lock receives are hedged: a message the losing attempt locked goes back on the queue
+// through Abandon, where a receive-and-delete duplicate would lose it. A loser cancelled after the
+// broker locked a message leaves it locked until the lock expires.
+task<ReceivedMessage> ServiceQueue::HedgeReceive(const wstring& endpoint, const wstring& authcode, bool parseJson, cancellation_token token)
+{
+	return Hedged<ReceivedMessage>(m_receiveLatency, token, [this, endpoint, authcode, parseJson](cancellation_token attempt)
+	{
+		return Receive(endpoint, authcode, ReceiveMode::PeekLock, parseJson, attempt);
+	}, [this, authcode](const ReceivedMessage& message)
+	{
+		if (message.HasMessage() && !message.lockLocation.empty())
+		{
+			Abandon(message, authcode);
+		}
+	});
+}
+
+// The duplicate waits for the configured percentile of the queue's total latency so far. The
+// hedge holds a callback slot until both attempts are over, so the destructor's drain also
+// covers the loser's discard.
+template <typename T>
+task<T> ServiceQueue::Hedged(const LatencyMetrics& latency, cancellation_token token, function<task<T>(cancellation_token)> attempt, function<void(const T&)> discard)
+{
+	chrono::milliseconds delay = m_hedge.initialDelay;
+	LatencySnapshot total = latency.Snapshot(LatencyPhase::Total);
+	if (total.count >= m_hedge.minSamples)
+	{
+		delay = (max)(m_hedge.minDelay, chrono::duration_cast<chrono::milliseconds>(chrono::microseconds(static_cast<long long>(total.Percentile(m_hedge.percentile)))));
+	}
+	m_hedgeBudget.Deposit();
+	m_callbacks.Acquire();
+	RetryBudget& budget = m_hedgeBudget;
+	atomic<size_t>& hedged = m_hedged;
+	InFlightWindow& callbacks = m_callbacks;
+	return Hedge<T>(token, attempt, m_timer.After(delay, token), [&budget, &hedged]()
+	{
+		if (!budget.Withdraw())
+		{
+			return false;
+		}
+		++hedged;
+		return true;
+	}, discard, [&callbacks]()
+	{
+		callbacks.Release();
+	});
+}
+
+template <typename T>
+task<T> ServiceQueue::Call(const CallOptions& options, function<task<T>(cancellation_token)> operation)
+{
+	auto call = make_shared<CallCancellation>(m_timer, options.timeout, m_shutdown.get_token(), options.token);
+	m_callbacks.Acquire();
+	InFlightWindow& callbacks = m_callbacks;
+	task<T> started;
+	try
+	{
+		started = operation(call->Token());
+	}
+	catch (...)
+	{
+		started = task_from_exception<T>(current_exception());
+	}
+	return started.then([call, &callbacks](task<T> done)
+	{
+		call->Release();
+		callbacks.Release();
+		return done.get();
+	});
+}
+
+task<ReceivedMessage> ServiceQueue::Receive(const wstring& endpoint, const wstring& authcode, ReceiveMode mode, bool parseJson, cancellation_token token)
+{
+	uri target(endpoint);
+	InFlightWindow& window = m_window;
+	LatencyMetrics& latency = m_receiveLatency;
+	auto timeline = make_shared<RequestTimeline>();
+	return m_window.Acquire().then([this, target, authcode, mode, parseJson, timeline, token]()
+	{
+		timeline->started = Clock::now();
+		if (token.is_canceled())
+		{
+			// Cancelled while waiting for a slot.
+			cancel_current_task();
+		}
+		auto client = m_pool.Acquire(target);
+		http_request request = CreateRequest(mode == ReceiveMode::PeekLock ? methods::POST : methods::DEL, target, authcode);
+		WatchUpload(request, timeline, 0);
+		// Have the body written into our own producer/consumer buffer so its blocks come from the
+		// shared block pool rather than a fresh heap allocation per chunk.
+		producer_consumer_buffer<uint8_t> inbound(InboundBlockBytes);
+		request.set_response_stream(inbound.create_ostream());
+		return m_pipeline.Send(client, request, token).then([this, client, inbound, parseJson, timeline](http_response response) -> task<ReceivedMessage>
+		{
+			timeline->headers = Clock::now();
+			ReceivedMessage message = ReadEnvelope(response);
+			auto& headers = response.headers();
+			bool sized = headers.has(header_names::content_length);
+			size_t length = sized ? static_cast<size_t>(headers.content_length()) : 0;
+			if ((sized && length == 0) || (parseJson && !message.HasMessage()))
+			{
+				return task_from_result(message);
+			}
+			// The client leaves caller-supplied streams open, so end the body once it has all arrived.
+			// A failed transfer closes it with the error, which faults the reader when it reaches the end.
+			auto ended = response.content_ready().then([inbound, timeline](task<http_response> ready) -> task<void>
+			{
+				producer_consumer_buffer<uint8_t> writer = inbound;
+				try
+				{
+					ready.wait();
+				}
+				catch (...)
+				{
+					return writer.close(ios_base::out, current_exception());
+				}
+				timeline->ended = Clock::now();
+				return writer.close(ios_base::out);
+			});
+			if (parseJson)
+			{
+				// Parse each chunk as it lands instead of holding the whole body first.
+				auto document = JsonStreamParser::ParseAsync(inbound);
+				return ended.then([document]()
+				{
+					return document;
+				}).then([message, timeline](json::value parsed)
+				{
+					timeline->parsed = Clock::now();
+					ReceivedMessage parsedMessage = message;
+					parsedMessage.document = std::move(parsed);
+					return parsedMessage;
+				});
+			}
+			// Size the pooled buffer from Content-Length so the body is read once, without regrowth.
+			auto body = ReadBody(inbound, m_buffers, m_buffers.Acquire(sized ? length : BufferPool::MinClassBytes), sized ? length : (numeric_limits<size_t>::max)());
+			return ended.then([body]()
+			{
+				return body;
+			}).then([message](shared_ptr<PooledBuffer> buffer)
+			{
+				ReceivedMessage received = message;
+				received.body = buffer;
+				return received;
+			});
+		});
+	}).then([&window, &latency, timeline](task<ReceivedMessage> received)
+	{
+		timeline->Record(latency);
+		window.Release();
+		return received.get();
+	});
+}
+
+task<status_code> ServiceQueue::Complete(const ReceivedMessage& message, const wstring& authcode)
+{
+	return m_settler.Enqueue(SettleAction::Complete, message.lockLocation, authcode);
+}
+
+task<status_code> ServiceQueue::Abandon(const ReceivedMessage& message, const wstring& authcode)
+{
+	return m_settler.Enqueue(SettleAction::Abandon, message.lockLocation, authcode);
+}
+
+task<status_code> ServiceQueue::RenewLock(const ReceivedMessage& message, const wstring& authcode)
+{
+	return m_settler.Enqueue(SettleAction::RenewLock, message.lockLocation, authcode);
+}
+
+task<vector<SendResult>> ServiceQueue::SendBatch(const wstring& endpoint, const wstring& authcode, const vector<json::value>& messages, size_t maxRequestBytes,
+	const CallOptions& options)
+{
+	// Every request of the batch shares the call's cancellation. The operation runs before Call
+	// returns, so it can read the messages by reference.
+	return Call<vector<SendResult>>(options, [&](cancellation_token token) -> task<vector<SendResult>>
+	{
+		vector<task<SendResult>> requests;
+		string batch;
+		// Reused across messages so serializing the batch allocates only as the largest message grows.
+		string body;
+		string item;
+		size_t count = 0;
+		// Serialize is recorded per batch request, covering the messages packed into it.
+		auto started = Clock::now();
+		for (auto& message : messages)
+		{
+			body.clear();
+			JsonWriter::Write(message, body);
+			item.assign("{\"Body\":");
+			JsonWriter::WriteString(body, item);
+			item.push_back('}');
+			if (!batch.empty() && batch.size() + item.size() + 2 > maxRequestBytes)
+			{
+				m_sendLatency.Record(LatencyPhase::Serialize, Clock::now() - started);
+				requests.push_back(Post(endpoint, authcode, batch + "]", L"application/vnd.microsoft.servicebus.json", count, token));
+				batch.clear();
+				count = 0;
+				started = Clock::now();
+			}
+			batch += batch.empty() ? "[" : ",";
+			batch += item;
+			++count;
+		}
+		if (!batch.empty())
+		{
+			m_sendLatency.Record(LatencyPhase::Serialize, Clock::now() - started);
+			requests.push_back(Post(endpoint, authcode, batch + "]", L"application/vnd.microsoft.servicebus.json", count, token));
+		}
+		if (requests.empty())
+		{
+			return task_from_result(vector<SendResult>());
+		}
+		return when_all(requests.begin(), requests.end());
+	});
+}
+
+task<SendResult> ServiceQueue::Post(const wstring& endpoint, const wstring& authcode, string body, const wstring& contentType, size_t messages,
+	cancellation_token token, const wstring& messageId)
+{
+	size_t length = body.size();
+	return Post(endpoint, authcode, bytestream::open_istream(move(body)), length, contentType, messages, token, messageId);
+}
+
+task<SendResult> ServiceQueue::Post(const wstring& endpoint, const wstring& authcode, Concurrency::streams::istream body, size_t length, const wstring& contentType, size_t messages,
+	cancellation_token token, const wstring& messageId)
+{
+	uri target(endpoint);
+	InFlightWindow& window = m_window;
+	AdaptiveLimiter& limiter = m_sendLimiter;
+	LatencyMetrics& latency = m_sendLatency;
+	auto timeline = make_shared<RequestTimeline>();
+	return m_sendLimiter.Acquire().then([&window]()
+	{
+		return window.Acquire();
+	}).then([this, target, authcode, body, length, contentType, messages, timeline, token, messageId]()
+	{
+		timeline->started = Clock::now();
+		if (token.is_canceled())
+		{
+			cancel_current_task();
+		}
+		auto client = m_pool.Acquire(target);
+		http_request request = CreateRequest(methods::POST, target, authcode);
+		request.set_body(body, length, contentType);
+		if (!messageId.empty())
+		{
+			request.headers().add(L"BrokerProperties", L"{\"MessageId\":\"" + messageId + L"\"}");
+		}
+		WatchUpload(request, timeline, length);
+		return m_pipeline.Send(client, request, token).then([client, messages, length, timeline](http_response response)
+		{
+			timeline->headers = Clock::now();
+			SendResult result;
+			result.status = response.status_code();
+			result.messages = messages;
+			result.bytes = length;
+			return result;
+		});
+	}).then([&window, &limiter, &latency, timeline, token](task<SendResult> sent)
+	{
+		if (timeline->started == Clock::time_point())
+		{
+			// Turned away by the send limiter without taking a slot.
+			return sent.get();
+		}
+		// Recorded before the slots are released, since the destructor only waits for the windows.
+		timeline->Record(latency);
+		bool overloaded = true;
+		bool cancelled = false;
+		try
+		{
+			status_code status = sent.get().status;
+			overloaded = status == 429 || status == status_codes::ServiceUnavailable;
+		}
+		catch (...)
+		{
+			cancelled = token.is_canceled();
+		}
+		Clock::time_point answered = timeline->headers == Clock::time_point() ? Clock::now() : timeline->headers;
+		window.Release();
+		if (cancelled)
+		{
+			// A cancelled send, such as a hedge loser, says nothing about the broker's load, and its
+			// truncated latency would drag the baseline down.
+			limiter.Abort();
+		}
+		else
+		{
+			limiter.Release(answered - timeline->started, overloaded);
+		}
+		return sent.get();
+	});
+}
+
+task<status_code> ServiceQueue::Settle(SettleAction action, const wstring& lockLocation, const wstring& authcode)
+{
+	uri target(lockLocation);
+	InFlightWindow& window = m_window;
+	return m_window.Acquire().then([this, target, authcode, action]()
+	{
+		auto client = m_pool.Acquire(target);
+		http_request request = CreateRequest(action == SettleAction::Complete ? methods::DEL : action == SettleAction::Abandon ? methods::PUT : methods::POST, target, authcode);
+		return m_pipeline.Send(client, request).then([client](http_response response)
+		{
+			return response.status_code();
+		});
+	}).then([&window](task<status_code> settled)
+	{
+		window.Release();
+		return settled.get();
+	});
+}
+
+http_request ServiceQueue::CreateRequest(const method& verb, const uri& target, const wstring& authcode)
+{
+	http_request request(verb);
+	request.set_request_uri(target.resource());
+	if (!authcode.empty())
+	{
+		request.headers().add(L"Authorization", authcode);
+		return request;
+	}
+	shared_ptr<SasTokenProvider> provider;
+	{
+		lock_guard<mutex> guard(m_providerLock);
+		provider = m_tokenProvider;
+	}
+	if (provider)
+	{
+		request.headers().add(L"Authorization", provider->GetToken(SasTokenProvider::ResourceFor(target)));
+	}
+	return request;
+}
@@ -1,14 +1,184 @@
 #pragma once
 #include <cpprest/http_client.h>
+#include <cpprest/json.h>
+#include <cpprest/rawptrstream.h>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include "AdaptiveLimiter.h"
+#include "BufferPool.h"
+#include "CallCancellation.h"
+#include "ClientPool.h"
+#include "Hedge.h"
+#include "InFlightWindow.h"
+#include "LatencyHistogram.h"
+#include "MessageSettler.h"
+#include "RequestPipeline.h"
+#include "RetryStage.h"
+#include "SasTokenProvider.h"
+#include "TaskTimer.h"
 using namespace ::pplx;
 using namespace std;
 
 namespace QED
 {
+	struct ServiceQueueConfig
+	{
+		ServiceQueueConfig();
+
+		ClientPoolConfig pool;
+		// Sends and receives beyond this many outstanding requests wait for a slot.
+		size_t maxInFlight;
+		// Settle calls are flushed once this many locks are pending or settleInterval passes.
+		size_t settleBatchSize;
+		chrono::milliseconds settleInterval;
+		// The queue's pipeline starts with a RetryStage built from this.
+		RetryStageConfig retry;
+		// Sends additionally wait for a slot under this adaptive limit, within maxInFlight.
+		AdaptiveLimiterConfig sendLimit;
+		// Duplicate slow receives and small sends on a second pooled client.
+		HedgeConfig hedge;
+	};
+
+	// Limits on one call. It is cancelled when token is, when timeout has passed since the call
+	// was made (zero for no deadline) or when the queue shuts down. The request is aborted in
+	// whatever phase it has reached, and the call's task is cancelled.
+	struct CallOptions
+	{
+		CallOptions();
+		explicit CallOptions(cancellation_token token);
+		explicit CallOptions(chrono::milliseconds timeout);
+		CallOptions(cancellation_token token, chrono::milliseconds timeout);
+
+		cancellation_token token;
+		chrono::milliseconds timeout;
+	};
+
+	enum class ReceiveMode
+	{
+		// POST to /messages/head: the message stays on the queue, locked, until it is settled.
+		PeekLock,
+		// DELETE to /messages/head: the message is removed as it is delivered.
+		ReceiveAndDelete
+	};
+
+	struct SendResult
+	{
+		web::http::status_code status;
+		size_t messages;
+		size_t bytes;
+
+		bool Succeeded() const;
+	};
+
+	struct ReceivedMessage
+	{
+		web::http::status_code status;
+		// UTF-8 message body in a pooled buffer, or null when the queue had nothing to deliver.
+		// Data and Size view it in place; the buffer is recycled once every copy of the message is gone.
+		shared_ptr<PooledBuffer> body;
+		// ReceiveJsonAsync only: the body, parsed as it streamed in. body stays null in that case.
+		web::json::value document;
+		// Peek-lock only: the lock URI that Complete, Abandon and RenewLock act on.
+		wstring lockLocation;
+		wstring lockToken;
+		long long sequenceNumber;
+		int deliveryCount;
+
+		bool HasMessage() const;
+		const char* Data() const;
+		size_t Size() const;
+	};
+
 	class ServiceQueue
 	{
 	public:
+		// The broker rejects requests over 256 KB; stay under it with room for the envelope headers.
+		static const size_t MaxBatchBytes = 256 * 1000;
+
+		ServiceQueue();
+		explicit ServiceQueue(const ServiceQueueConfig&);
+		// Waits for outstanding sends and receives before releasing the pooled clients; call Shutdown
+		// first to cut them short.
+		~ServiceQueue();
 		void SendJSON(const wstring&, const wstring&);
 		void ReceiveJSON(const wstring&, const wstring&);
+		// Transport failures fault the returned task; broker errors complete it with their status.
+		task<SendResult> SendAsync(const wstring&, const wstring&, const web::json::value&, const CallOptions& options = CallOptions());
+		// Streams the caller's bytes straight into the request without an intermediate string or
+		// UTF-16 pass. The memory is borrowed, so it must stay untouched until the task completes;
+		// sends small enough to be hedged are copied instead.
+		task<SendResult> SendAsync(const wstring&, const wstring&, const uint8_t*, size_t, const wstring& contentType = L"application/octet-stream",
+			const CallOptions& options = CallOptions());
+		task<SendResult> SendAsync(const wstring&, const wstring&, Concurrency::streams::rawptr_buffer<uint8_t>, size_t, const wstring& contentType = L"application/octet-stream",
+			const CallOptions& options = CallOptions());
+		// A peek-lock receive cancelled after the broker locked a message leaves it locked until the
+		// lock expires.
+		task<ReceivedMessage> ReceiveAsync(const wstring&, const wstring&, ReceiveMode mode = ReceiveMode::PeekLock, const CallOptions& options = CallOptions());
+		// Parses the body incrementally as it arrives rather than buffering it first. Only deliveries
+		// are parsed; a malformed body faults the task.
+		task<ReceivedMessage> ReceiveJsonAsync(const wstring&, const wstring&, ReceiveMode mode = ReceiveMode::PeekLock, const CallOptions& options = CallOptions());
+		// Settle calls are batched by the queue's MessageSettler and complete with the broker status.
+		// They are short and release locks, so Shutdown lets them finish rather than cancelling them.
+		task<web::http::status_code> Complete(const ReceivedMessage&, const wstring&);
+		task<web::http::status_code> Abandon(const ReceivedMessage&, const wstring&);
+		task<web::http::status_code> RenewLock(const ReceivedMessage&, const wstring&);
+		// Packs the messages into as few batch requests as fit under maxRequestBytes each.
+		task<vector<SendResult>> SendBatch(const wstring&, const wstring&, const vector<web::json::value>&, size_t maxRequestBytes = MaxBatchBytes,
+			const CallOptions& options = CallOptions());
+		// Flushes pending settle calls, waits for every outstanding request and then trims the
+		// process-wide response block pool.
+		task<void> Drain();
+		// Cancels every outstanding send and receive, then drains. Later calls are cancelled at once.
+		task<void> Shutdown();
+		ClientPool& Pool();
+		InFlightWindow& Window();
+		// Stages every queue request passes through before its client; they may be added at any time.
+		RequestPipeline& Pipeline();
+		AdaptiveLimiter& SendLimiter();
+		RetryStage& Retry();
+		// Duplicate requests sent by hedging.
+		size_t Hedged() const;
+		// Per-phase latency of every send and receive, including failed ones, since construction or
+		// the last Reset. Recording is lock-free, so snapshots can be taken while requests run.
+		LatencyMetrics& SendLatency();
+		LatencyMetrics& ReceiveLatency();
+		// Signs requests made with an empty authcode; explicit authcodes are always sent as given.
+		void SetTokenProvider(shared_ptr<SasTokenProvider>);
+
+	private:
+		task<SendResult> Post(const wstring&, const wstring&, string, const wstring&, size_t,
+			cancellation_token token, const wstring& messageId = wstring());
+		task<SendResult> Post(const wstring&, const wstring&, Concurrency::streams::istream, size_t, const wstring&, size_t,
+			cancellation_token token, const wstring& messageId = wstring());
+		task<ReceivedMessage> Receive(const wstring&, const wstring&, ReceiveMode, bool, cancellation_token token);
+		task<ReceivedMessage> HedgeReceive(const wstring&, const wstring&, bool, cancellation_token);
+		template <typename T>
+		task<T> Hedged(const LatencyMetrics&, cancellation_token, function<task<T>(cancellation_token)>, function<void(const T&)>);
+		// Runs operation under the call's cancellation, holding a callback slot until the links are undone.
+		template <typename T>
+		task<T> Call(const CallOptions&, function<task<T>(cancellation_token)> operation);
+		task<web::http::status_code> Settle(SettleAction, const wstring&, const wstring&);
+		web::http::http_request CreateRequest(const web::http::method&, const web::uri&, const wstring&);
+
+		ClientPool m_pool;
+		BufferPool m_buffers;
+		InFlightWindow m_window;
+		RequestPipeline m_pipeline;
+		// Tracks SendJSON/ReceiveJSON continuations that still touch the queue after their request.
+		InFlightWindow m_callbacks;
+		MessageSettler m_settler;
+		shared_ptr<SasTokenProvider> m_tokenProvider;
+		mutex m_providerLock;
+		TaskTimer m_timer;
+		cancellation_token_source m_shutdown;
+		LatencyMetrics m_sendLatency;
+		LatencyMetrics m_receiveLatency;
+		AdaptiveLimiter m_sendLimiter;
+		shared_ptr<RetryStage> m_retry;
+		HedgeConfig m_hedge;
+		RetryBudget m_hedgeBudget;
+		atomic<size_t> m_hedged;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,184 @@
+#include "TaskTimer.h"
+#include <vector>
+
+using namespace ::pplx;
+using namespace QED;
+using namespace std;
+
+TaskTimer::TaskTimer()
+	: m_lastId(0), m_stopping(false)
+{
+	m_thread = thread([this]() { Run(); });
+}
+
+TaskTimer::~TaskTimer()
+{
+	Schedule abandoned;
+	{
+		lock_guard<mutex> guard(m_lock);
+		m_stopping = true;
+		abandoned.swap(m_due);
+	}
+	m_wake.notify_all();
+	m_thread.join();
+	for (auto& entry : abandoned)
+	{
+		// Waits out a cancellation callback already running, so none outlives the timer.
+		Unlink(entry.second);
+		entry.second.fired.set_exception(task_canceled());
+	}
+}
+
+task<void> TaskTimer::After(chrono::milliseconds delay)
+{
+	task_completion_event<void> fired;
+	if (delay.count() <= 0)
+	{
+		fired.set();
+		return create_task(fired);
+	}
+	{
+		lock_guard<mutex> guard(m_lock);
+		if (m_stopping)
+		{
+			fired.set_exception(task_canceled());
+			return create_task(fired);
+		}
+		Insert(clock::now() + delay, fired);
+	}
+	return create_task(fired);
+}
+
+task<void> TaskTimer::After(chrono::milliseconds delay, cancellation_token token)
+{
+	if (!token.is_cancelable() || delay.count() <= 0)
+	{
+		return After(delay);
+	}
+	task_completion_event<void> fired;
+	clock::time_point due;
+	unsigned long long id;
+	{
+		lock_guard<mutex> guard(m_lock);
+		if (m_stopping || token.is_canceled())
+		{
+			fired.set_exception(task_canceled());
+			return create_task(fired);
+		}
+		due = clock::now() + delay;
+		id = Insert(due, fired);
+	}
+	// Registered outside the lock, since a token cancelled in the meantime runs the callback here.
+	cancellation_token_registration registration = token.register_callback([this, due, id]()
+	{
+		Drop(due, id);
+	});
+	bool queued;
+	{
+		lock_guard<mutex> guard(m_lock);
+		auto entry = Find(due, id);
+		queued = entry != m_due.end();
+		if (queued)
+		{
+			entry->second.token = token;
+			entry->second.registration = registration;
+		}
+	}
+	if (!queued)
+	{
+		// Already fired or dropped.
+		token.deregister_callback(registration);
+	}
+	return create_task(fired);
+}
+
+size_t TaskTimer::Pending() const
+{
+	lock_guard<mutex> guard(m_lock);
+	return m_due.size();
+}
+
+void TaskTimer::Run()
+{
+	unique_lock<mutex> guard(m_lock);
+	while (!m_stopping)
+	{
+		if (m_due.empty())
+		{
+			m_wake.wait(guard);
+			continue;
+		}
+		auto now = clock::now();
+		if (m_due.begin()->first > now)
+		{
+			m_wake.wait_until(guard, m_due.begin()->first);
+			continue;
+		}
+		vector<Due> fired;
+		while (!m_due.empty() && m_due.begin()->first <= now)
+		{
+			fired.push_back(m_due.begin()->second);
+			m_due.erase(m_due.begin());
+		}
+		guard.unlock();
+		for (auto& entry : fired)
+		{
+			Unlink(entry);
+			entry.fired.set();
+		}
+		guard.lock();
+	}
+}
+
+unsigned long long TaskTimer::Insert(clock::time_point due, const task_completion_event<void>& fired)
+{
+	bool earliest = m_due.empty() || due < m_due.begin()->first;
+	Due entry;
+	entry.id = ++m_lastId;
+	entry.fired = fired;
+	m_due.insert(make_pair(due, entry));
+	if (earliest)
+	{
+		m_wake.notify_one();
+	}
+	return entry.id;
+}
+
+TaskTimer::Schedule::iterator TaskTimer::Find(clock::time_point due, unsigned long long id)
+{
+	auto range = m_due.equal_range(due);
+	for (auto entry = range.first; entry != range.second; ++entry)
+	{
+		if (entry->second.id == id)
+		{
+			return entry;
+		}
+	}
+	return m_due.end();
+}
+
+void TaskTimer::Drop(clock::time_point due, unsigned long long id)
+{
+	task_completion_event<void> fired;
+	{
+		lock_guard<mutex> guard(m_lock);
+		auto entry = Find(due, id);
+		if (entry == m_due.end())
+		{
+			return;
+		}
+		fired = entry->second.fired;
+		m_due.erase(entry);
+	}
+	fired.set_exception(task_canceled());
+}
+
+// Called without the lock: deregistering waits for a callback in progress, which takes it.
+void TaskTimer::Unlink(Due& entry)
+{
+	if (entry.token.is_cancelable())
+	{
+		entry.token.deregister_callback(entry.registration);
+		entry.token = cancellation_token::none();
+	}
+}
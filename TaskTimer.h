@@ -0,0 +1,57 @@
+#pragma once
+#include <pplx/pplxtasks.h>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace QED
+{
+	// Completes tasks after a delay from one background thread. Delays still pending when the
+	// timer is destroyed are cancelled, so value-based continuations on them never run.
+	class TaskTimer
+	{
+	public:
+		TaskTimer();
+		~TaskTimer();
+
+		pplx::task<void> After(std::chrono::milliseconds delay);
+		// Cancelling token drops the delay at once and cancels its task, so a deadline that is no
+		// longer needed does not stay queued until it would have fired.
+		pplx::task<void> After(std::chrono::milliseconds delay, pplx::cancellation_token token);
+		size_t Pending() const;
+
+	private:
+		typedef std::chrono::steady_clock clock;
+
+		struct Due
+		{
+			Due() : id(0), token(pplx::cancellation_token::none()) {}
+
+			unsigned long long id;
+			pplx::task_completion_event<void> fired;
+			// Set once the cancellation callback is registered; removed when the delay fires.
+			pplx::cancellation_token token;
+			pplx::cancellation_token_registration registration;
+		};
+		typedef std::multimap<clock::time_point, Due> Schedule;
+
+		void Run();
+		// Caller holds m_lock.
+		unsigned long long Insert(clock::time_point due, const pplx::task_completion_event<void>& fired);
+		Schedule::iterator Find(clock::time_point due, unsigned long long id);
+		void Drop(clock::time_point due, unsigned long long id);
+		static void Unlink(Due& entry);
+
+		Schedule m_due;
+		unsigned long long m_lastId;
+		bool m_stopping;
+		mutable std::mutex m_lock;
+		std::condition_variable m_wake;
+		std::thread m_thread;
+
+		TaskTimer(const TaskTimer&);
+		TaskTimer& operator=(const TaskTimer&);
+	};
+}
@@ -0,0 +1,245 @@
+#include "Utf.h"
+#include <emmintrin.h>
+#include <stdexcept>
+
+using namespace QED;
+using namespace utility;
+using namespace std;
+
+namespace
+{
+	// Length of the leading run of ASCII bytes.
+	size_t AsciiPrefix(const uint8_t* data, size_t length)
+	{
+		size_t i = 0;
+		for (; i + 16 <= length; i += 16)
+		{
+			__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+			if (_mm_movemask_epi8(block) != 0)
+			{
+				break;
+			}
+		}
+		while (i < length && data[i] < 0x80)
+		{
+			++i;
+		}
+		return i;
+	}
+
+	// Widens ASCII bytes to UTF-16 code units; the caller has already checked them.
+	void WidenAscii(const uint8_t* data, size_t length, utf16char* out)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		size_t i = 0;
+		for (; i + 16 <= length; i += 16)
+		{
+			__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi8(block, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), _mm_unpackhi_epi8(block, zero));
+		}
+		for (; i < length; ++i)
+		{
+			out[i] = static_cast<utf16char>(data[i]);
+		}
+	}
+
+	// Narrows a leading run of code units below 0x80 and returns its length.
+	size_t NarrowAscii(const utf16char* data, size_t length, uint8_t* out)
+	{
+		const __m128i high = _mm_set1_epi16(static_cast<short>(0xFF80));
+		const __m128i zero = _mm_setzero_si128();
+		size_t i = 0;
+		for (; i + 16 <= length; i += 16)
+		{
+			__m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+			__m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 8));
+			__m128i bits = _mm_and_si128(_mm_or_si128(first, second), high);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(bits, zero)) != 0xFFFF)
+			{
+				break;
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(first, second));
+		}
+		for (; i < length && static_cast<unsigned>(data[i]) < 0x80; ++i)
+		{
+			out[i] = static_cast<uint8_t>(data[i]);
+		}
+		return i;
+	}
+
+	void Invalid()
+	{
+		throw range_error("invalid UTF-8");
+	}
+
+	// Decodes one multi-byte sequence starting at data[i], advancing i past it.
+	unsigned DecodeUtf8(const uint8_t* data, size_t length, size_t& i)
+	{
+		uint8_t lead = data[i];
+		unsigned codePoint;
+		size_t extra;
+		// Bounds on the second byte exclude overlong forms, surrogates and values past U+10FFFF.
+		uint8_t lower = 0x80;
+		uint8_t upper = 0xBF;
+		if (lead >= 0xC2 && lead <= 0xDF)
+		{
+			codePoint = lead & 0x1F;
+			extra = 1;
+		}
+		else if (lead >= 0xE0 && lead <= 0xEF)
+		{
+			codePoint = lead & 0x0F;
+			extra = 2;
+			lower = lead == 0xE0 ? 0xA0 : 0x80;
+			upper = lead == 0xED ? 0x9F : 0xBF;
+		}
+		else if (lead >= 0xF0 && lead <= 0xF4)
+		{
+			codePoint = lead & 0x07;
+			extra = 3;
+			lower = lead == 0xF0 ? 0x90 : 0x80;
+			upper = lead == 0xF4 ? 0x8F : 0xBF;
+		}
+		else
+		{
+			Invalid();
+			return 0;
+		}
+		if (length - i <= extra)
+		{
+			Invalid();
+		}
+		for (size_t k = 1; k <= extra; ++k)
+		{
+			uint8_t c = data[i + k];
+			if (c < lower || c > upper)
+			{
+				Invalid();
+			}
+			lower = 0x80;
+			upper = 0xBF;
+			codePoint = (codePoint << 6) | (c & 0x3F);
+		}
+		i += extra + 1;
+		return codePoint;
+	}
+}
+
+void QED::AppendUtf16(const char* utf8, size_t length, utf16string& out)
+{
+	const uint8_t* data = reinterpret_cast<const uint8_t*>(utf8);
+	// A UTF-8 string never needs more code units than it has bytes, so size once and trim after.
+	size_t base = out.size();
+	out.resize(base + length);
+	utf16char* target = &out[0] + base;
+	size_t written = 0;
+	size_t i = 0;
+	while (i < length)
+	{
+		size_t ascii = AsciiPrefix(data + i, length - i);
+		WidenAscii(data + i, ascii, target + written);
+		i += ascii;
+		written += ascii;
+		// Decode the non-ASCII run, going back to the vector path at the next ASCII byte.
+		while (i < length && data[i] >= 0x80)
+		{
+			unsigned codePoint = DecodeUtf8(data, length, i);
+			if (codePoint >= 0x10000)
+			{
+				codePoint -= 0x10000;
+				target[written++] = static_cast<utf16char>(0xD800 + (codePoint >> 10));
+				target[written++] = static_cast<utf16char>(0xDC00 + (codePoint & 0x3FF));
+			}
+			else
+			{
+				target[written++] = static_cast<utf16char>(codePoint);
+			}
+		}
+	}
+	out.resize(base + written);
+}
+
+void QED::AppendUtf8(const utf16char* utf16, size_t length, string& out)
+{
+	// Three bytes per code unit covers the worst case; a surrogate pair is two units for four bytes.
+	size_t base = out.size();
+	out.resize(base + length * 3);
+	uint8_t* target = reinterpret_cast<uint8_t*>(&out[0] + base);
+	size_t written = 0;
+	size_t i = 0;
+	while (i < length)
+	{
+		size_t ascii = NarrowAscii(utf16 + i, length - i, target + written);
+		i += ascii;
+		written += ascii;
+		while (i < length && static_cast<unsigned>(utf16[i]) >= 0x80)
+		{
+			unsigned c = static_cast<unsigned>(utf16[i++]);
+			if (c < 0x800)
+			{
+				target[written++] = static_cast<uint8_t>(0xC0 | (c >> 6));
+				target[written++] = static_cast<uint8_t>(0x80 | (c & 0x3F));
+				continue;
+			}
+			if (c >= 0xD800 && c <= 0xDBFF && i < length && utf16[i] >= 0xDC00 && utf16[i] <= 0xDFFF)
+			{
+				unsigned codePoint = 0x10000 + ((c - 0xD800) << 10) + (static_cast<unsigned>(utf16[i++]) - 0xDC00);
+				target[written++] = static_cast<uint8_t>(0xF0 | (codePoint >> 18));
+				target[written++] = static_cast<uint8_t>(0x80 | ((codePoint >> 12) & 0x3F));
+				target[written++] = static_cast<uint8_t>(0x80 | ((codePoint >> 6) & 0x3F));
+				target[written++] = static_cast<uint8_t>(0x80 | (codePoint & 0x3F));
+				continue;
+			}
+			if (c >= 0xD800 && c <= 0xDFFF)
+			{
+				c = 0xFFFD;
+			}
+			target[written++] = static_cast<uint8_t>(0xE0 | (c >> 12));
+			target[written++] = static_cast<uint8_t>(0x80 | ((c >> 6) & 0x3F));
+			target[written++] = static_cast<uint8_t>(0x80 | (c & 0x3F));
+		}
+	}
+	out.resize(base + written);
+}
+
+utf16string QED::Utf8ToUtf16(const string& utf8)
+{
+	utf16string result;
+	AppendUtf16(utf8.data(), utf8.size(), result);
+	return result;
+}
+
+string QED::Utf16ToUtf8(const utf16string& utf16)
+{
+	string result;
+	AppendUtf8(utf16.data(), utf16.size(), result);
+	return result;
+}
+
+string_t QED::ToStringT(const char* utf8, size_t length)
+{
+#ifdef _UTF16_STRINGS
+	string_t result;
+	AppendUtf16(utf8, length, result);
+	return result;
+#else
+	return string_t(utf8, length);
+#endif
+}
+
+string_t QED::ToStringT(const string& utf8)
+{
+	return ToStringT(utf8.data(), utf8.size());
+}
+
+string QED::ToUtf8(const string_t& text)
+{
+#ifdef _UTF16_STRINGS
+	string result;
+	AppendUtf8(text.data(), text.size(), result);
+	return result;
+#else
+	return text;
+#endif
+}
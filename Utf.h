@@ -0,0 +1,24 @@
+#pragma once
+#include <cpprest/asyncrt_utils.h>
+#include <cstddef>
+#include <string>
+
+namespace QED
+{
+	// UTF-8/UTF-16 conversion for the hot paths that otherwise go through utility::conversions.
+	// Runs of ASCII are converted 16 characters at a time with SSE2; only the rest is decoded one
+	// character at a time. The Append forms add to a caller's buffer so it can be reused.
+
+	// Invalid UTF-8 throws std::range_error, as utility::conversions does.
+	void AppendUtf16(const char* utf8, size_t length, utf16string& out);
+	// Unpaired surrogates are written as U+FFFD rather than rejected.
+	void AppendUtf8(const utf16char* utf16, size_t length, std::string& out);
+
+	utf16string Utf8ToUtf16(const std::string& utf8);
+	std::string Utf16ToUtf8(const utf16string& utf16);
+
+	// string_t forms, which only copy on platforms where string_t is already UTF-8.
+	utility::string_t ToStringT(const char* utf8, size_t length);
+	utility::string_t ToStringT(const std::string& utf8);
+	std::string ToUtf8(const utility::string_t& text);
+}
@@ -34,6 +34,9 @@
 #include <queue>
 #include <algorithm>
 #include <iterator>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 #if defined(_MSC_VER) && (_MSC_VER >= 1800)
 #include <ppltasks.h>
@@ -62,6 +65,229 @@ namespace Concurrency { namespace streams {
 
     namespace details {
 
+        /// <summary>
+        /// Hit and miss counters for the producer/consumer block pool.
+        /// </summary>
+        struct _block_pool_stats
+        {
+            // Allocations served from a free list
+            size_t hits;
+
+            // Allocations that had to go to the heap
+            size_t misses;
+
+            // Released blocks kept for reuse
+            size_t recycled;
+
+            // Released blocks returned to the heap because their shard was full or they were oversized
+            size_t discarded;
+
+            // Bytes currently held in free lists across all shards
+            size_t cached_bytes;
+
+            double hit_rate() const
+            {
+                return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(hits + misses);
+            }
+        };
+
+        /// <summary>
+        /// Size-classed pool backing the memory blocks of producer/consumer buffers. Block sizes are rounded
+        /// up to a power of two between 512 bytes and 1MB; larger blocks bypass the pool. Free lists are split
+        /// into shards chosen by the calling thread, so workers allocating and releasing blocks concurrently
+        /// rarely contend on the same lock. Each shard caches at most max_cached_bytes_per_shard, and only a
+        /// couple of blocks per class from 64KB up, so a burst of large bodies cannot pin its peak memory;
+        /// trim() hands everything cached back to the heap.
+        /// </summary>
+        class _block_pool
+        {
+        public:
+            /// <summary>
+            /// Allocates at least <paramref name="bytes"/> bytes and reports the usable size in <paramref name="capacity"/>.
+            /// </summary>
+            static void * allocate(size_t bytes, size_t &capacity)
+            {
+                size_t index = class_index(bytes);
+                if (index == class_count)
+                {
+                    capacity = bytes;
+                    instance().misses++;
+                    return ::operator new(bytes);
+                }
+
+                capacity = min_class_bytes << index;
+                state &pool = instance();
+                shard &local = pool.shards[shard_index()];
+                {
+                    std::lock_guard<std::mutex> guard(local.lock);
+                    std::vector<void *> &list = local.free[index];
+                    if (!list.empty())
+                    {
+                        void *data = list.back();
+                        list.pop_back();
+                        local.cached_bytes -= capacity;
+                        pool.hits++;
+                        return data;
+                    }
+                }
+                pool.misses++;
+                return ::operator new(capacity);
+            }
+
+            /// <summary>
+            /// Returns a block obtained from allocate(); <paramref name="capacity"/> must be the size it reported.
+            /// </summary>
+            static void release(void *data, size_t capacity)
+            {
+                if (data == nullptr) return;
+
+                state &pool = instance();
+                size_t index = class_index(capacity);
+                if (index != class_count && (min_class_bytes << index) == capacity)
+                {
+                    shard &local = pool.shards[shard_index()];
+                    std::lock_guard<std::mutex> guard(local.lock);
+                    std::vector<void *> &list = local.free[index];
+                    if (list.size() < class_slots(index) && local.cached_bytes + capacity <= max_cached_bytes_per_shard)
+                    {
+                        list.push_back(data);
+                        local.cached_bytes += capacity;
+                        pool.recycled++;
+                        return;
+                    }
+                }
+                pool.discarded++;
+                ::operator delete(data);
+            }
+
+            /// <summary>
+            /// Frees every cached block and returns the number of bytes handed back to the heap.
+            /// </summary>
+            static size_t trim()
+            {
+                state &pool = instance();
+                size_t freed = 0;
+                for (size_t i = 0; i < shard_count; ++i)
+                {
+                    std::vector<void *> blocks[class_count];
+                    {
+                        std::lock_guard<std::mutex> guard(pool.shards[i].lock);
+                        for (size_t index = 0; index < class_count; ++index)
+                        {
+                            blocks[index].swap(pool.shards[i].free[index]);
+                        }
+                        freed += pool.shards[i].cached_bytes;
+                        pool.shards[i].cached_bytes = 0;
+                    }
+                    for (size_t index = 0; index < class_count; ++index)
+                    {
+                        for (auto data : blocks[index])
+                        {
+                            ::operator delete(data);
+                        }
+                    }
+                }
+                return freed;
+            }
+
+            static _block_pool_stats stats()
+            {
+                state &pool = instance();
+                _block_pool_stats result;
+                result.hits = pool.hits;
+                result.misses = pool.misses;
+                result.recycled = pool.recycled;
+                result.discarded = pool.discarded;
+                result.cached_bytes = 0;
+                for (size_t i = 0; i < shard_count; ++i)
+                {
+                    std::lock_guard<std::mutex> guard(pool.shards[i].lock);
+                    result.cached_bytes += pool.shards[i].cached_bytes;
+                }
+                return result;
+            }
+
+        private:
+            static const size_t min_class_bytes = 512;
+            static const size_t class_count = 12;
+            static const size_t shard_count = 8;
+            static const size_t max_cached_per_shard = 32;
+            // Classes from this size up keep only max_cached_large_per_shard blocks.
+            static const size_t large_class_bytes = 64 * 1024;
+            static const size_t max_cached_large_per_shard = 2;
+            static const size_t max_cached_bytes_per_shard = 4 * 1024 * 1024;
+
+            struct shard
+            {
+                std::mutex lock;
+                std::vector<void *> free[class_count];
+                size_t cached_bytes;
+
+                shard() : cached_bytes(0) { }
+            };
+
+            struct state
+            {
+                shard shards[shard_count];
+                std::atomic<size_t> hits;
+                std::atomic<size_t> misses;
+                std::atomic<size_t> recycled;
+                std::atomic<size_t> discarded;
+
+                state() : hits(0), misses(0), recycled(0), discarded(0) { }
+            };
+
+            // Function-local statics are not initialized thread-safely on every supported compiler, so the
+            // pool is published through an atomic pointer instead. It lives for the rest of the process,
+            // since buffers may still be releasing blocks during static destruction.
+            template<typename _Dummy>
+            struct holder
+            {
+                static std::atomic<state *> s_instance;
+            };
+
+            static state & instance()
+            {
+                state *current = holder<void>::s_instance.load();
+                if (current == nullptr)
+                {
+                    state *created = new state();
+                    if (holder<void>::s_instance.compare_exchange_strong(current, created))
+                    {
+                        current = created;
+                    }
+                    else
+                    {
+                        delete created;
+                    }
+                }
+                return *current;
+            }
+
+            static size_t class_index(size_t bytes)
+            {
+                size_t index = 0;
+                for (size_t size = min_class_bytes; size < bytes; size <<= 1)
+                {
+                    if (++index == class_count) break;
+                }
+                return index;
+            }
+
+            static size_t class_slots(size_t index)
+            {
+                return (min_class_bytes << index) >= large_class_bytes ? max_cached_large_per_shard : max_cached_per_shard;
+            }
+
+            static size_t shard_index()
+            {
+                return std::hash<std::thread::id>()(std::this_thread::get_id()) % shard_count;
+            }
+        };
+
+        template<typename _Dummy>
+        std::atomic<_block_pool::state *> _block_pool::holder<_Dummy>::s_instance;
+
         /// <summary>
         /// The basic_producer_consumer_buffer class serves as a memory-based steam buffer that supports both writing and reading
         /// sequences of characters. It can be used as a consumer/producer buffer.
@@ -454,13 +680,17 @@ namespace Concurrency { namespace streams {
             {
             public:
                 _block(size_t size)
-                    : m_read(0), m_pos(0), m_size(size), m_data(new _CharType[size]) 
+                    : m_read(0), m_pos(0), m_size(size), m_data(nullptr)
                 {
+                    // Storage comes from the shared block pool; any slack in the size class is usable space.
+                    size_t capacity = 0;
+                    m_data = static_cast<_CharType *>(_block_pool::allocate(size * sizeof(_CharType), capacity));
+                    m_size = capacity / sizeof(_CharType);
                 }
 
                 ~_block()
                 {
-                    delete [] m_data;
+                    _block_pool::release(m_data, m_size * sizeof(_CharType));
                 }
 
                 // Read head